@@ -0,0 +1,282 @@
+#include "mesh.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+static double now_sec(void) {
+#ifdef _OPENMP
+    return omp_get_wtime();
+#else
+    return (double) clock() / (double) CLOCKS_PER_SEC;
+#endif
+}
+
+// Quad soup on a jittered grid: every quad owns its 4 corners, like quad()/stitch() output,
+// so each interior position is duplicated 4 times and welding collapses it back.
+static void build_soup(QMesh *m, int targetVerts) {
+    int side = 1;
+    while ((side + 1) * (side + 1) * 4 < targetVerts) side++;
+    unsigned seed = 12345u;
+    for (int j = 0; j < side; j++) {
+        for (int i = 0; i < side; i++) {
+            int base = m->vCount;
+            for (int c = 0; c < 4; c++) {
+                int x = i + (c == 1 || c == 2), y = j + (c >= 2);
+                seed = seed * 1664525u + 1013904223u;
+                float jit = ((float) (seed >> 8) / 16777216.0f - 0.5f) * 1e-5f;
+                qm_addv(m, (Vector3) {(float) x * 0.01f + jit, (float) y * 0.01f - jit, 0.0f});
+            }
+            qm_addq(m, base, base + 1, base + 2, base + 3);
+        }
+    }
+}
+
+static void bench_weld(int n) {
+    QMesh m;
+    qm_init(&m);
+    build_soup(&m, n);
+    int before = m.vCount;
+    double t0 = now_sec();
+    mesh_weld_by_distance(&m, 1e-4f);
+    double dt = now_sec() - t0;
+    printf("weld      %9d verts -> %9d  %8.3f ms  %7.1f Mverts/s\n",
+           before, m.vCount, dt * 1e3, (double) before / dt * 1e-6);
+    qm_free(&m);
+}
+
+static void report(const char *what, int n, int reps, double dt) {
+    printf("%-9s %9d verts  %8.3f ms  %7.1f Mverts/s/core\n",
+           what, n, dt * 1e3 / reps, (double) n * reps / dt * 1e-6);
+}
+
+// Transform kernels are single-threaded, so throughput is per core.
+static void bench_kernels(int n) {
+    QMesh m, dst;
+    qm_init(&m);
+    qm_init(&dst);
+    build_soup(&m, n);
+    n = m.vCount;
+    int reps = 100000000 / n + 1;
+    float mn[3], mx[3];
+    double t0 = now_sec();
+    for (int r = 0; r < reps; r++) mesh_move(&m, 0.001f, -0.001f, 0.0005f);
+    report("move", n, reps, now_sec() - t0);
+    t0 = now_sec();
+    for (int r = 0; r < reps; r++) mesh_scale(&m, 1.0001f, 0.9999f, 1.0f);
+    report("scale", n, reps, now_sec() - t0);
+    t0 = now_sec();
+    for (int r = 0; r < reps; r++) mesh_rotate_y(&m, 0.01f);
+    report("rotate_y", n, reps, now_sec() - t0);
+    t0 = now_sec();
+    for (int r = 0; r < reps; r++) mesh_bbox_minmax(&m, &mn[0], &mn[1], &mn[2], &mx[0], &mx[1], &mx[2]);
+    report("bbox", n, reps, now_sec() - t0);
+    int mreps = reps < 64 ? reps : 64;
+    t0 = now_sec();
+    for (int r = 0; r < mreps; r++) {
+        dst.vCount = dst.qCount = 0;
+        mesh_merge(&dst, &m);
+    }
+    report("merge", n, mreps, now_sec() - t0);
+    t0 = now_sec();
+    for (int r = 0; r < mreps; r++) {
+        dst.vCount = m.vCount;
+        dst.qCount = m.qCount;
+        mesh_mirror_x(&dst, 1e-6f);
+    }
+    report("mirror_x", n, mreps, now_sec() - t0);
+    qm_free(&m);
+    qm_free(&dst);
+}
+
+// Height field of n quads with a sine bump, one shared vertex per grid point.
+static void build_terrain(QMesh *m, int n) {
+    int side = 1;
+    while ((side + 1) * (side + 1) <= n) side++;
+    qm_reserve(m, (side + 1) * (side + 1), side * side);
+    for (int j = 0; j <= side; j++)
+        for (int i = 0; i <= side; i++) {
+            float x = (float) i / (float) side, y = (float) j / (float) side;
+            qm_addv(m, (Vector3) {x, y, 0.05f * sinf(x * 20.0f) * cosf(y * 20.0f)});
+        }
+    for (int j = 0; j < side; j++)
+        for (int i = 0; i < side; i++) {
+            int a = j * (side + 1) + i;
+            qm_addq(m, a, a + 1, a + side + 2, a + side + 1);
+        }
+}
+
+// Queries are single-threaded; the first raycast pays for the BVH build.
+static void bench_bvh(int n) {
+    QMesh m;
+    qm_init(&m);
+    build_terrain(&m, n);
+    QMeshHit hit;
+    double t0 = now_sec();
+    mesh_raycast(&m, (Vector3) {0.5f, 0.5f, 1.0f}, (Vector3) {0, 0, -1}, 10.0f, &hit);
+    double build = now_sec() - t0;
+    const int rays = 1000000;
+    unsigned seed = 777u;
+    int hits = 0;
+    t0 = now_sec();
+    for (int r = 0; r < rays; r++) {
+        seed = seed * 1664525u + 1013904223u;
+        float x = (float) (seed >> 8) / 16777216.0f;
+        seed = seed * 1664525u + 1013904223u;
+        float y = (float) (seed >> 8) / 16777216.0f;
+        hits += mesh_raycast(&m, (Vector3) {x, y, 1.0f}, (Vector3) {0.3f, -0.2f, -1.0f}, 10.0f, &hit);
+    }
+    double dtRay = now_sec() - t0;
+    t0 = now_sec();
+    for (int r = 0; r < rays; r++) {
+        seed = seed * 1664525u + 1013904223u;
+        float x = (float) (seed >> 8) / 16777216.0f, y = 1.0f - x;
+        // just off the surface, like snapping a part onto it
+        float z = 0.05f * sinf(x * 20.0f) * cosf(y * 20.0f) + 0.01f;
+        mesh_closest_point(&m, (Vector3) {x, y, z}, INFINITY, &hit);
+    }
+    double dtClosest = now_sec() - t0;
+    printf("bvh       %9d quads  build %8.3f ms  raycast %6.2f Mq/s (%d hits)  closest %6.2f Mq/s\n",
+           m.qCount, build * 1e3, rays / dtRay * 1e-6, hits, rays / dtClosest * 1e-6);
+    qm_free(&m);
+}
+
+// Four flat tiles of n/4 quads in a 2x2 block, welded along the seams: weld(merge(...))
+// against merge_weld, which hashes only the seam strips.
+static void bench_merge_weld(int n) {
+    QMesh tiles[4];
+    const QMesh *src[4];
+    for (int t = 0; t < 4; t++) {
+        qm_init(&tiles[t]);
+        build_terrain(&tiles[t], n / 4);
+        mesh_scale(&tiles[t], 1.0f, 1.0f, 0.0f);
+        mesh_move(&tiles[t], (float) (t & 1), (float) (t >> 1), 0.0f);
+        src[t] = &tiles[t];
+    }
+    int before = 0;
+    for (int t = 0; t < 4; t++) before += tiles[t].vCount;
+    QMesh a, b;
+    qm_init(&a);
+    qm_init(&b);
+    double t0 = now_sec();
+    for (int t = 0; t < 4; t++) mesh_merge(&a, src[t]);
+    mesh_weld_by_distance(&a, 1e-5f);
+    double dtWeld = now_sec() - t0;
+    t0 = now_sec();
+    mesh_merge_weld(&b, src, 4, 1e-5f, NULL, NULL);
+    double dtFused = now_sec() - t0;
+    printf("mergeweld %9d verts -> %9d / %9d  weld(merge) %8.3f ms  merge_weld %8.3f ms\n",
+           before, a.vCount, b.vCount, dtWeld * 1e3, dtFused * 1e3);
+    qm_free(&a);
+    qm_free(&b);
+    for (int t = 0; t < 4; t++) qm_free(&tiles[t]);
+}
+
+// Many small parts merged into one mesh, as a scene of copied pieces ends: one mesh_merge per
+// part against a single mesh_merge_n over all of them.
+static void bench_merge_n(int n) {
+    QMesh part;
+    qm_init(&part);
+    build_soup(&part, 64);
+    const int parts = n / part.vCount > 0 ? n / part.vCount : 1;
+    const QMesh **src = (const QMesh **) malloc(sizeof(QMesh *) * (size_t) parts);
+    for (int i = 0; i < parts; i++) src[i] = &part;
+    QMesh a, b;
+    qm_init(&a);
+    qm_init(&b);
+    double t0 = now_sec();
+    for (int i = 0; i < parts; i++) mesh_merge(&a, src[i]);
+    double dtSeq = now_sec() - t0;
+    t0 = now_sec();
+    mesh_merge_n(&b, src, parts);
+    double dtBulk = now_sec() - t0;
+    bool same = a.vCount == b.vCount && a.qCount == b.qCount &&
+                !memcmp(a.v, b.v, sizeof(Vector3) * (size_t) a.vCount) &&
+                !memcmp(a.q, b.q, sizeof(Quad) * (size_t) a.qCount);
+    printf("merge_n   %9d verts %7d parts  merge %8.3f ms  merge_n %8.3f ms  %s\n",
+           b.vCount, parts, dtSeq * 1e3, dtBulk * 1e3, same ? "same" : "DIFFERENT");
+    qm_free(&a);
+    qm_free(&b);
+    qm_free(&part);
+    free(src);
+}
+
+// Dual contouring of a smooth union of a rounded box and two capsules, a cushion-like shape.
+static void bench_polygonize(int res) {
+    QSdf box = {QSDF_BOX, {0, 0, 0, 0.5f, 0.5f, 0.1f, 0.05f}, NULL, NULL};
+    QSdf roll0 = {QSDF_CAPSULE, {-0.5f, 0.5f, 0.1f, 0.5f, 0.5f, 0.1f, 0.12f}, NULL, NULL};
+    QSdf roll1 = {QSDF_CAPSULE, {-0.5f, -0.5f, 0.1f, 0.5f, -0.5f, 0.1f, 0.12f}, NULL, NULL};
+    QSdf u0 = {QSDF_SMOOTH_UNION, {0.1f}, &box, &roll0};
+    QSdf u1 = {QSDF_SMOOTH_UNION, {0.1f}, &u0, &roll1};
+    float mn[3], mx[3];
+    sdf_bounds(&u1, mn, mx);
+    QMesh m;
+    qm_init(&m);
+    double t0 = now_sec();
+    mesh_polygonize(&m, &u1, mn, mx, res);
+    double dt = now_sec() - t0;
+    printf("polygonize res %4d -> %9d verts %9d quads  %8.3f ms\n", res, m.vCount, m.qCount, dt * 1e3);
+    qm_free(&m);
+}
+
+// Soup with its vertices shuffled, as if built in scattered order: weld and BVH build with and
+// without a Morton reorder first (the reorder's own time is reported separately).
+static void bench_reorder(int n) {
+    QMesh a, b;
+    qm_init(&a);
+    build_soup(&a, n);
+    int *perm = (int *) malloc(sizeof(int) * (size_t) a.vCount);
+    Vector3 *tmp = (Vector3 *) malloc(sizeof(Vector3) * (size_t) a.vCount);
+    for (int i = 0; i < a.vCount; i++) perm[i] = i;
+    unsigned seed = 99u;
+    for (int i = a.vCount - 1; i > 0; i--) {
+        seed = seed * 1664525u + 1013904223u;
+        int j = (int) ((seed >> 8) % (unsigned) (i + 1)), t = perm[i];
+        perm[i] = perm[j];
+        perm[j] = t;
+    }
+    for (int i = 0; i < a.vCount; i++) tmp[perm[i]] = a.v[i];
+    memcpy(a.v, tmp, sizeof(Vector3) * (size_t) a.vCount);
+    for (int q = 0; q < a.qCount; q++)
+        a.q[q] = (Quad) {perm[a.q[q].a], perm[a.q[q].b], perm[a.q[q].c], perm[a.q[q].d]};
+    free(tmp);
+    free(perm);
+    qm_init(&b);
+    mesh_merge(&b, &a);
+
+    double t0 = now_sec();
+    mesh_reorder_spatial(&b, NULL, NULL);
+    double dtSort = now_sec() - t0;
+    double dt[2][2];
+    QMesh *ms[2] = {&a, &b};
+    for (int k = 0; k < 2; k++) {
+        t0 = now_sec();
+        mesh_weld_by_distance(ms[k], 1e-4f);
+        dt[k][0] = now_sec() - t0;
+        QMeshHit hit;
+        t0 = now_sec();
+        mesh_raycast(ms[k], (Vector3) {0.5f, 0.5f, 1.0f}, (Vector3) {0, 0, -1}, 10.0f, &hit);
+        dt[k][1] = now_sec() - t0;
+    }
+    printf("morton    %9d verts  sort %8.3f ms  weld %8.3f -> %8.3f ms  bvh %8.3f -> %8.3f ms\n",
+           a.qCount * 4, dtSort * 1e3, dt[0][0] * 1e3, dt[1][0] * 1e3, dt[0][1] * 1e3, dt[1][1] * 1e3);
+    qm_free(&a);
+    qm_free(&b);
+}
+
+int main(int argc, char **argv) {
+    int maxVerts = argc > 1 ? atoi(argv[1]) : 10000000;
+    for (int n = 10000; n <= maxVerts; n *= 10) bench_weld(n);
+    for (int n = 10000; n <= maxVerts; n *= 10) bench_kernels(n);
+    for (int n = 10000; n <= maxVerts && n <= 1000000; n *= 10) bench_bvh(n);
+    for (int n = 10000; n <= maxVerts; n *= 10) bench_merge_weld(n);
+    for (int n = 10000; n <= maxVerts; n *= 10) bench_merge_n(n);
+    for (int n = 10000; n <= maxVerts; n *= 10) bench_reorder(n);
+    for (int res = 32; res <= 256; res *= 2) bench_polygonize(res);
+    return 0;
+}
@@ -16,6 +16,10 @@ void *arena_alloc(TopoArena *A, size_t sz, size_t align);
 
 void arena_reset(TopoArena *A);
 
+size_t arena_mark(const TopoArena *A);
+
+void arena_release(TopoArena *A, size_t mark);
+
 void arena_destroy(TopoArena *A);
 
 #endif
@@ -18,6 +18,8 @@ typedef struct {
             QRing **ptrs;
             int count;
         } ringlist;
+        float *bbox; // min xyz, then max xyz
+        const QSdf *sdf;
     };
 } Value;
 
@@ -27,12 +29,15 @@ enum {
     VAL_STRING,
     VAL_MESH,
     VAL_RING,
-    VAL_RINGLIST
+    VAL_RINGLIST,
+    VAL_BBOX,
+    VAL_SDF
 };
 
 typedef struct Host {
     TopoArena *arena;
     QMesh *build;
+    QTemplates *tpl;  // ring and cap templates shared by every frame of one execution
 
     void *(*alloc)(struct Host *H, size_t sz, size_t align);
 } Host;
@@ -45,4 +50,13 @@ typedef struct {
 
 const Builtin *intrinsics_table(int *outCount);
 
+// Builder vertex count, to be passed back to host_builder_release.
+int host_builder_mark(const Host *H);
+
+// Reclaims builder vertices appended since `mark` that `keep` cannot reach. Rings in `keep`
+// are moved down to start at `mark`; meshes own their vertices and only lose their refs into
+// the released range. H is the caller's Host: the builder's allocator is pointed back at it,
+// since the callee's Host that last grew the builder no longer exists.
+void host_builder_release(Host *H, int mark, Value *keep);
+
 #endif
@@ -4,6 +4,8 @@
 #include <stdbool.h>
 #include <raymath.h>
 
+// Custom allocators are only asked for fresh blocks (p == NULL): growth copies the old contents
+// itself and passes the old block to free_fn, so realloc_fn never needs to know a block's size.
 typedef struct {
     void *(*realloc_fn)(void *ud, void *p, size_t sz, size_t align);
 
@@ -16,14 +18,56 @@ typedef struct {
     int a, b, c, d;
 } Quad;
 
+// Connectivity of a QMesh in CSR form. Corners are numbered quad * 4 + k; corner k's edge runs
+// to corner (k + 1) & 3. Edges with one corner are boundary, with more than two non-manifold.
+typedef struct QMeshAdj {
+    int vCount, qCount, eCount;
+    int *vStart, *vCorner;  // vertex -> its corners, ascending
+    int *edgeOf;            // corner -> edge id, or -1 when both ends are the same vertex
+    int *eVert;             // 2 per edge, lower vertex index first
+    int *eStart, *eCorner;  // edge -> corners whose edge it is, ascending
+} QMeshAdj;
+
+// One placement of a plain mesh; xf is row-major 3x4 like MeshKernels.affine.
 typedef struct {
+    const struct QMesh *base;
+    float xf[12];
+} QMeshInst;
+
+typedef struct QMesh {
     Vector3 *v;
     int vCount, vCap;
     Quad *q;
     int qCount, qCap;
     QAllocator alloc;
+    // Optional, parallel to v: index of the refSrc (builder) vertex each vertex is an exact copy
+    // of, or -1. Copies of one builder vertex are shared lazily by mesh_share_refs; anything that
+    // moves vertices drops the refs.
+    int *ref;
+    const struct QMesh *refSrc;
+    // Cached bounds of v, or of the placements of an instanced mesh, kept up to date by appends,
+    // merge, move and scale when cheap and otherwise recomputed on the next mesh_bbox. Adding an
+    // instance clears them.
+    float bbMin[3], bbMax[3];
+    bool bbValid;
+    // Built by mesh_adjacency on first use (on the system heap, whatever alloc is); dropped when
+    // quads are rewritten or counts change.
+    QMeshAdj *adj;
+    // Built by the spatial queries on first use, on the system heap like adj; dropped like adj
+    // and whenever vertices move.
+    struct QMeshBVH *bvh;
+    // Placements this mesh stands for, kept symbolic by mesh_instance. A mesh holds either its
+    // own vertices and quads or instances, never both, and bases never hold instances.
+    QMeshInst *inst;
+    int instCount, instCap;
 } QMesh;
 
+typedef struct {
+    float t;     // distance along the ray in units of its direction, or to the query point
+    int quad;
+    Vector3 p;
+} QMeshHit;
+
 typedef struct {
     Vector3 *v;
     int vCount;
@@ -45,8 +89,28 @@ void qm_set_alloc(QMesh *m, QAllocator alloc);
 
 void qm_free(QMesh *m);
 
+// Makes room for vCap vertices and qCap quads in total. Growth is geometric, so reserving
+// ahead of every append on a long-lived mesh stays amortized; an empty mesh gets exactly vCap/qCap.
+void qm_reserve(QMesh *m, int vCap, int qCap);
+
 int qm_addv(QMesh *m, Vector3 p);
 
+// Bulk appends; return the index of the first new element. p and q must not point into m.
+int qm_addv_n(QMesh *m, const Vector3 *p, int n);
+
+int qm_addq_n(QMesh *m, const Quad *q, int n);
+
+// Appends a copy of src->v[i] that remembers where it came from.
+int qm_addv_ref(QMesh *m, const QMesh *src, int i);
+
+void qm_drop_refs(QMesh *m);
+
+// Must be called after writing m->v directly; drops cached data derived from the positions.
+void qm_touch(QMesh *m);
+
+// Must be called after rewriting m->q in place; drops the cached adjacency.
+void qm_touch_quads(QMesh *m);
+
 void qm_addq(QMesh *m, int a, int b, int c, int d);
 
 QRing qr_new(void);
@@ -55,10 +119,22 @@ QRing qr_new_with_alloc(QAllocator alloc);
 
 void qr_free(QRing *r);
 
+void qr_reserve(QRing *r, int cap);
+
 void qr_push(QRing *r, int i);
 
+// Per-context cache of unit-circle tables and cap grid templates, keyed by segment count.
+typedef struct QTemplates QTemplates;
+
+QTemplates *qt_new(void);
+
+void qt_free(QTemplates *t);
+
 QRing ring_ellipse(QMesh *m, float cx, float cy, float rx, float ry, int segs);
 
+// Same as ring_ellipse, reading cos/sin from t's table for segs (built on first use).
+QRing ring_ellipse_cached(QMesh *m, QTemplates *t, float cx, float cy, float rx, float ry, int segs);
+
 QRing ring_grow_out(QMesh *m, const QRing *base, float step, float dz);
 
 void ring_lift_x(QMesh *m, QRing *r, float dx);
@@ -69,6 +145,10 @@ void ring_lift_z(QMesh *m, QRing *r, float dz);
 
 QMesh *cap_plane_build(QMesh *b, const QRing *outer, void *(*alloc)(void *, size_t, size_t), void *ud);
 
+// Same as cap_plane_build, replaying t's grid layout and blend weights for the ring size.
+QMesh *cap_plane_build_cached(QMesh *b, QTemplates *t, const QRing *outer,
+                              void *(*alloc)(void *, size_t, size_t), void *ud);
+
 bool stitch(QMesh *m, const QRing *a, const QRing *b);
 
 bool stitch_loop(QMesh *m, QRing *rings, int n);
@@ -79,6 +159,29 @@ void mesh_move(QMesh *m, float dx, float dy, float dz);
 
 void mesh_scale(QMesh *m, float sx, float sy, float sz);
 
+// Applies M (raymath convention) to every vertex in one pass; winding is reversed when M
+// mirrors, so faces keep pointing outward.
+void mesh_transform(QMesh *m, const Matrix *M);
+
+// Appends all n meshes (instanced ones flattened) in one allocation: slots come from prefix
+// sums of the counts, and the copies run in parallel. Same result as n mesh_merge calls.
+void mesh_merge_n(QMesh *dst, const QMesh *const *src, int n);
+
+// Appends src transformed by M to dst without an intermediate copy.
+void mesh_merge_transform(QMesh *dst, const QMesh *src, const Matrix *M);
+
+// Appends src placed by M to dst as instances instead of copying its vertices; instances of
+// src are re-based onto their own bases with composed transforms. dst must hold no geometry,
+// and src must outlive dst.
+void mesh_instance(QMesh *dst, const QMesh *src, const Matrix *M);
+
+// n placements of src translated by offsets, appended in one sized allocation.
+void mesh_instance_offsets(QMesh *dst, const QMesh *src, const Vector3 *offsets, int n);
+
+// Replaces m's instances with transformed copies of their bases. mesh_merge and
+// mesh_merge_transform flatten instanced sources on the fly.
+void mesh_flatten(QMesh *m);
+
 void mesh_rotate_x(QMesh *m, float rad);
 
 void mesh_rotate_y(QMesh *m, float rad);
@@ -91,11 +194,140 @@ void mesh_mirror_y(QMesh *m, float weldEps);
 
 void mesh_mirror_z(QMesh *m, float weldEps);
 
+// Writes two triangles (6 indices, offset by base) per quad into out. Quads split along a-c,
+// or along whichever diagonal is shorter when choose_shortest_diag is set.
+void mesh_triangulate_indices(const Vector3 *v, const Quad *q, int qCount, unsigned base,
+                              int choose_shortest_diag, int flip_winding, unsigned *out);
+
+// Average cache misses per triangle for a FIFO post-transform cache of cacheSize entries.
+float mesh_acmr(const unsigned *indices, int iCount, int vCount, int cacheSize);
+
+// Reorders triangles in place for a cacheSize-entry vertex cache (Tipsify).
+void mesh_optimize_vertex_cache(unsigned *indices, int iCount, int vCount, int cacheSize);
+
+// Renumbers vertices in first-use order: rewrites indices and fills remap[old] = new, with
+// unreferenced vertices placed after the used ones. Returns the number of used vertices.
+int mesh_optimize_vertex_fetch_remap(unsigned *indices, int iCount, int vCount, int *remap);
+
+// remap[old] = new for vertices sorted by 30-bit Morton code over their cubed bounds (stable LSD
+// radix sort, parallel over fixed-size chunks).
+void mesh_morton_remap(const Vector3 *v, int n, int *remap, void *(*alloc)(void *, size_t, size_t), void *ud);
+
+// Renumbers vertices in Morton order and rewrites the quads to match; geometry is unchanged.
+void mesh_reorder_spatial(QMesh *m, void *(*alloc)(void *, size_t, size_t), void *ud);
+
+// out->v borrows src->v; out->indices comes from alloc, or malloc when alloc is NULL.
 void mesh_triangulate_quads(const QMesh *src, TMesh *out, int choose_shortest_diag, int flip_winding,
                             void *(*alloc)(void *, size_t, size_t), void *ud);
 
 void mesh_weld_by_distance(QMesh *m, float eps);
 
+void mesh_weld_by_distance_ex(QMesh *m, float eps, void *(*alloc)(void *, size_t, size_t), void *ud);
+
+// Appends the n meshes to dst in one allocation and welds vertices within eps of a vertex from
+// another input, keeping the lower index. Inputs are taken as already welded: only vertices
+// inside the overlap of two inputs' bounds (grown by eps) are hashed, and vertices of one input
+// never merge with each other.
+void mesh_merge_weld(QMesh *dst, const QMesh *const *src, int n, float eps,
+                     void *(*alloc)(void *, size_t, size_t), void *ud);
+
+// Collapses vertices copied from the same source vertex into one, keeping the first copy.
+void mesh_share_refs(QMesh *m, void *(*alloc)(void *, size_t, size_t), void *ud);
+
+void mesh_compact(QMesh *m, void *(*alloc)(void *, size_t, size_t), void *ud);
+
+// Area- and angle-weighted unit normals, 3 floats per vertex, malloc'd. With creaseRad > 0 a
+// vertex whose faces meet more sharply is split, one copy per smooth fan: m gains the copies,
+// its quads are re-pointed, and the result covers the new m->vCount.
+float *mesh_vertex_normals(QMesh *m, float creaseRad, void *(*alloc)(void *, size_t, size_t), void *ud);
+
+// Cached connectivity, built in O(V + Q) on first use after a change.
+const QMeshAdj *mesh_adjacency(const QMesh *m);
+
+// Catmull-Clark subdivision, levels times. Each level turns every quad into 4; boundary and
+// non-manifold edges are kept as creases. Vertices must already be shared (weld/share_refs).
+void mesh_subdivide(QMesh *m, int levels);
+
+// Quadric error edge collapse down to ratio of the triangle count (quads count as two), stopping
+// early once the cheapest collapse would move the surface by more than maxError (RMS distance;
+// INFINITY for no limit). Quads on a collapsed edge become triangles with a repeated corner.
+// Open edges stay in place, vertices on non-manifold edges never move. Vertices must already be
+// shared; the result is compacted. Returns the triangles left.
+int mesh_simplify(QMesh *m, float ratio, float maxError, void *(*alloc)(void *, size_t, size_t), void *ud);
+
+// Spatial queries over a cached BVH (binned SAH over quad bounds, quads tested as the triangles
+// a-b-c and a-c-d). The first query after a change builds it in O(Q log Q). An instanced mesh
+// keeps its instances; the BVH indexes a flattened copy, and hit quads count in the order
+// mesh_flatten would produce.
+bool mesh_raycast(const QMesh *m, Vector3 origin, Vector3 dir, float tMax, QMeshHit *hit);
+
+bool mesh_closest_point(const QMesh *m, Vector3 p, float maxDist, QMeshHit *hit);
+
+// True when the surfaces touch or cross; a mesh wholly inside a closed one does not count.
+bool mesh_overlaps(const QMesh *a, const QMesh *b);
+
+// Releases a BVH built by the spatial queries, with the flattened copy it may hold.
+void mesh_bvh_free(struct QMeshBVH *bvh);
+
+// Primitives, appended to m with one reservation and shared vertices; quads face outward.
+// Cylinder and tube run along +Z from z = 0; caps are a grid like cap_plane when segs is a
+// multiple of 4, otherwise a fan of triangles.
+void mesh_cylinder(QMesh *m, float r, float len, int segs, int rings, bool caps);
+
+void mesh_tube(QMesh *m, float rOuter, float rInner, float len, int segs, bool caps);
+
+// Sweeps the profile (its x, y as offsets in the moving frame) along the open polyline path with
+// rotation-minimizing frames, turning it by twist radians and scaling it linearly from 1 to
+// endScale over the length. The profile sits on the path exactly as drawn when the path starts
+// up +Z. Repeated path points are skipped; fewer than two distinct ones add nothing.
+void mesh_sweep(QMesh *m, const Vector3 *profile, int pc, const Vector3 *path, int n, float twist,
+                float endScale, bool caps);
+
+// Centred on the origin, segs quads along every edge.
+void mesh_box(QMesh *m, float sx, float sy, float sz, int segs);
+
+// A subdivided cube pushed onto the sphere, 6 * segs^2 quads.
+void mesh_sphere(QMesh *m, float r, int segs);
+
+// Around +Z: segs steps around the axis, sides around the tube.
+void mesh_torus(QMesh *m, float R, float r, int segs, int sides);
+
+// Signed distance description for mesh_polygonize, negative inside. Leaves are spheres, boxes
+// and capsules; the other nodes combine child a (and b). Every node keeps the distance a lower
+// bound (1-Lipschitz), so the polygonizer may skip blocks far from the surface.
+enum {
+    QSDF_SPHERE,        // p: centre xyz, radius
+    QSDF_BOX,           // p: centre xyz, half size xyz, edge radius (rounded inside the size)
+    QSDF_CAPSULE,       // p: end a xyz, end b xyz, radius
+    QSDF_UNION,
+    QSDF_SMOOTH_UNION,  // p[0]: blend radius
+    QSDF_SUBTRACT,      // a with b carved out
+    QSDF_INTERSECT,
+    QSDF_ROUND          // a grown by p[0]
+};
+
+typedef struct QSdf {
+    int op;
+    float p[7];
+    const struct QSdf *a, *b;
+} QSdf;
+
+float sdf_eval(const QSdf *s, Vector3 p);
+
+// Conservative bounds of the surface; mn > mx on some axis when it is empty.
+void sdf_bounds(const QSdf *s, float mn[3], float mx[3]);
+
+// Dual contouring of s over [mn, mx] plus one cell on every side, with cubic cells sized so the
+// longest axis gets res of them. Appends one vertex per cell the surface crosses, placed by a
+// QEF over the edge crossings and clamped to the cell, and one outward quad per crossed edge, so
+// the vertices come out shared. Sampling runs over 8^3-corner blocks on OpenMP threads and skips
+// blocks the distance at their centre shows to be empty.
+void mesh_polygonize(QMesh *m, const QSdf *s, const float mn[3], const float mx[3], int res);
+
+// Bounds of every vertex, all zero for an empty mesh. Served from the cache when valid;
+// instanced meshes are bounded through their bases without being flattened.
+void mesh_bbox(const QMesh *m, float mn[3], float mx[3]);
+
 void mesh_bbox_minmax(const QMesh *m, float *minx, float *miny, float *minz,
                       float *maxx, float *maxy, float *maxz);
 
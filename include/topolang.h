@@ -26,11 +26,21 @@ typedef struct {
     int vCount;
     int *quads;
     int qCount;
+    float *normals; // xyz per vertex when requested through TopoExecOptions, else NULL
 } TopoMesh;
 
+typedef struct {
+    int mesh;            // index into TopoScene.meshes
+    float transform[16]; // column-major 4x4, as in glTF node matrices
+} TopoInstance;
+
+// Without instances every mesh is placed once as is. With them only the instances are drawn,
+// and a mesh may be placed any number of times.
 typedef struct {
     TopoMesh *meshes;
     int count;
+    TopoInstance *instances;
+    int instanceCount;
 } TopoScene;
 
 typedef struct TopoProgram TopoProgram;
@@ -59,11 +69,35 @@ bool
 topo_compile_ex(const TopoSource *sources, int nSources, const TopoOptions *opt, TopoArena *A, TopoProgram **outProg,
                 TopoError *err);
 
+typedef struct {
+    bool compact;   // drop unreferenced vertices, degenerate and duplicate quads from the result
+    bool normals;   // fill TopoMesh.normals with area/angle weighted vertex normals
+    float crease_deg; // with normals: split vertices where faces meet at more than this angle (0 = all smooth)
+    bool instances; // keep meshes placed more than once shared, listed in TopoScene.instances
+} TopoExecOptions;
+
 bool topo_execute(const TopoProgram *prog, const char *entryMeshName,
                   TopoArena *A, TopoScene *outScene, TopoError *err);
 
+bool topo_execute_ex(const TopoProgram *prog, const char *entryMeshName, const TopoExecOptions *opt,
+                     TopoArena *A, TopoScene *outScene, TopoError *err);
+
+typedef struct {
+    bool optimize;  // reorder triangles for the GPU vertex cache, then vertices for fetch locality
+    int lod_count;  // simplified levels written after the full mesh, chained with MSFT_lod
+    float lod_ratio; // triangles each level keeps from the one before (0 = 0.5)
+    bool spatial_order; // number vertices in Morton order first (optimize then renumbers by first use)
+} TopoExportOptions;
+
+typedef struct {
+    float acmr_before, acmr_after; // average vertex cache misses per triangle (16-entry FIFO)
+} TopoExportStats;
+
 bool topo_export_gltf(const TopoScene *scene, const char *outGltfPath, TopoError *err);
 
+bool topo_export_gltf_ex(const TopoScene *scene, const char *outGltfPath, const TopoExportOptions *opt,
+                         TopoExportStats *stats, TopoError *err);
+
 bool topo_export_obj_ex(const TopoScene *scene, const char *outObjPath, int triangulate, TopoError *err);
 
 bool topo_export_obj(const TopoScene *scene, const char *outObjPath, TopoError *err);
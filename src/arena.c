@@ -27,6 +27,14 @@ void arena_reset(TopoArena *A) {
     A->off = 0;
 }
 
+size_t arena_mark(const TopoArena *A) {
+    return A->off;
+}
+
+void arena_release(TopoArena *A, size_t mark) {
+    if (mark <= A->off) A->off = mark;
+}
+
 void arena_destroy(TopoArena *A) {
     if (A) {
         free(A->base);
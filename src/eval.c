@@ -114,8 +114,15 @@ static Value merge_meshes(TopoArena *A, Value a, Value b) {
     if (a.k == VAL_MESH && b.k == VAL_MESH) {
         QMesh *out = (QMesh *) arena_alloc(A, sizeof(QMesh), 8);
         qm_init(out);
-        mesh_merge(out, a.mesh);
-        mesh_merge(out, b.mesh);
+        if (a.mesh->instCount || b.mesh->instCount) {
+            // stays symbolic, like merge()
+            Matrix I = MatrixIdentity();
+            mesh_instance(out, a.mesh, &I);
+            mesh_instance(out, b.mesh, &I);
+        } else {
+            mesh_merge(out, a.mesh);
+            mesh_merge(out, b.mesh);
+        }
         Value v;
         memset(&v, 0, sizeof(v));
         v.k = VAL_MESH;
@@ -266,6 +273,7 @@ static Value call_user_fn(Exec *E, FnDef *F, Ast *call) {
         setVar(&C, fn->func.params[i].name, vals[i]);
     }
 
+    const int builderMark = host_builder_mark(&E->host);
     (void) eval_node(&C, fn->func.body);
     if (C.err[0]) {
         strsncpy(E->err, C.err, 256);
@@ -284,6 +292,8 @@ static Value call_user_fn(Exec *E, FnDef *F, Ast *call) {
         return zero_val();
     }
 
+    // the call's locals are gone; only what it returns can still reach its builder vertices
+    host_builder_release(&E->host, builderMark, &C.ret);
     return C.ret;
 }
 
@@ -542,14 +552,18 @@ bool eval_block_to_value(Ast *block, TopoArena *A, EvalResult *out, char err[256
     memset(&E, 0, sizeof(E));
     E.A = A;
     E.host.arena = A;
-    E.host.build = NULL;
+    // created up front so every call frame's copy of the Host points at the same builder
+    E.host.build = (QMesh *) arena_alloc(A, sizeof(QMesh), 8);
+    qm_init(E.host.build);
     E.host.alloc = host_arena_alloc;
+    E.host.tpl = qt_new();
     E.err[0] = 0;
     E.hasRet = 0;
     int nbi = 0;
     GBI = intrinsics_table(&nbi);
     GBI_N = nbi;
     (void) eval_node(&E, block);
+    qt_free(E.host.tpl);
     if (E.err[0]) {
         if (err) strsncpy(err, E.err, 256);
         return false;
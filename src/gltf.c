@@ -1,53 +1,166 @@
 #include "topolang.h"
+#include "mesh.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
 
-typedef struct {
-    float *v;
-    int vCount;
-    unsigned int *idx;
-    int idxCount;
-} TriMesh;
+// Post-transform cache size assumed by the optimizer and the ACMR figures.
+#define GLTF_CACHE_SIZE 16
 
-static TriMesh tri_from_quad(const TopoMesh *qm) {
-    TriMesh t = {0};
-    t.vCount = qm->vCount;
-    t.v = (float *) malloc(sizeof(float) * 3 * t.vCount);
-    memcpy(t.v, qm->vertices, sizeof(float) * 3 * t.vCount);
-    t.idxCount = qm->qCount * 6;
-    t.idx = (unsigned int *) malloc(sizeof(unsigned int) * t.idxCount);
-    for (int i = 0; i < qm->qCount; i++) {
-        int a = qm->quads[i * 4 + 0], b = qm->quads[i * 4 + 1], c = qm->quads[i * 4 + 2], d = qm->quads[i * 4 + 3];
-        t.idx[i * 6 + 0] = a;
-        t.idx[i * 6 + 1] = b;
-        t.idx[i * 6 + 2] = c;
-        t.idx[i * 6 + 3] = a;
-        t.idx[i * 6 + 4] = c;
-        t.idx[i * 6 + 5] = d;
-    }
-    return t;
+// Applies remap (old -> new) to an xyz stream through a scratch copy.
+static void permute_xyz(float *xyz, const int *remap, int n, float *tmp) {
+    for (int i = 0; i < n; i++) memcpy(tmp + (size_t) remap[i] * 3, xyz + (size_t) i * 3, sizeof(float) * 3);
+    memcpy(xyz, tmp, sizeof(float) * 3 * (size_t) n);
 }
 
 bool topo_export_gltf(const TopoScene *scene, const char *outGltfPath, TopoError *err) {
-    TriMesh all = {0};
-    int totalV = 0, totalI = 0;
-    for (int i = 0; i < scene->count; i++) {
-        totalV += scene->meshes[i].vCount;
-        totalI += scene->meshes[i].qCount * 6;
-    }
-    all.v = (float *) malloc(sizeof(float) * 3 * totalV);
-    all.idx = (unsigned int *) malloc(sizeof(unsigned int) * totalI);
-    int vo = 0, io = 0, base = 0;
-    for (int i = 0; i < scene->count; i++) {
-        TriMesh t = tri_from_quad(&scene->meshes[i]);
-        memcpy(all.v + vo * 3, t.v, sizeof(float) * 3 * t.vCount);
-        for (int k = 0; k < t.idxCount; k++) all.idx[io + k] = t.idx[k] + base;
-        vo += t.vCount;
-        io += t.idxCount;
-        base += t.vCount;
-        free(t.v);
-        free(t.idx);
+    return topo_export_gltf_ex(scene, outGltfPath, NULL, NULL, err);
+}
+
+// One glTF mesh: triangulated positions, optional normals and indices, all malloc'd.
+typedef struct {
+    float *v, *n;
+    unsigned *idx;
+    int vCount, iCount;
+} GltfLevel;
+
+static void gltf_level_free(GltfLevel *L) {
+    free(L->v);
+    free(L->n);
+    free(L->idx);
+}
+
+// Concatenates meshes (laid out like TopoMesh storage) into one level.
+static void gltf_level_build(GltfLevel *L, const QMesh *meshes, float *const *normals, int count, bool hasN) {
+    L->vCount = L->iCount = 0;
+    for (int i = 0; i < count; i++) {
+        L->vCount += meshes[i].vCount;
+        L->iCount += meshes[i].qCount * 6;
+    }
+    L->v = (float *) malloc(sizeof(float) * 3 * (size_t) L->vCount);
+    L->n = hasN ? (float *) malloc(sizeof(float) * 3 * (size_t) L->vCount) : NULL;
+    L->idx = (unsigned *) malloc(sizeof(unsigned) * (size_t) L->iCount);
+    int vo = 0, io = 0;
+    for (int i = 0; i < count; i++) {
+        const QMesh *m = &meshes[i];
+        if (m->vCount) memcpy(L->v + (size_t) vo * 3, m->v, sizeof(float) * 3 * (size_t) m->vCount);
+        if (L->n && m->vCount) memcpy(L->n + (size_t) vo * 3, normals[i], sizeof(float) * 3 * (size_t) m->vCount);
+        mesh_triangulate_indices(m->v, m->q, m->qCount, (unsigned) vo, 1, 0, L->idx + io);
+        vo += m->vCount;
+        io += m->qCount * 6;
+    }
+}
+
+static void gltf_level_spatial(GltfLevel *L) {
+    if (L->vCount < 2) return;
+    int *remap = (int *) malloc(sizeof(int) * (size_t) L->vCount);
+    float *tmp = (float *) malloc(sizeof(float) * 3 * (size_t) L->vCount);
+    mesh_morton_remap((const Vector3 *) L->v, L->vCount, remap, NULL, NULL);
+    permute_xyz(L->v, remap, L->vCount, tmp);
+    if (L->n) permute_xyz(L->n, remap, L->vCount, tmp);
+    for (int i = 0; i < L->iCount; i++) L->idx[i] = (unsigned) remap[L->idx[i]];
+    free(tmp);
+    free(remap);
+}
+
+static void gltf_level_optimize(GltfLevel *L) {
+    if (L->iCount == 0) return;
+    mesh_optimize_vertex_cache(L->idx, L->iCount, L->vCount, GLTF_CACHE_SIZE);
+    int *remap = (int *) malloc(sizeof(int) * (size_t) L->vCount);
+    float *tmp = (float *) malloc(sizeof(float) * 3 * (size_t) L->vCount);
+    mesh_optimize_vertex_fetch_remap(L->idx, L->iCount, L->vCount, remap);
+    permute_xyz(L->v, remap, L->vCount, tmp);
+    if (L->n) permute_xyz(L->n, remap, L->vCount, tmp);
+    free(tmp);
+    free(remap);
+}
+
+// Identity matrices are left out of the node.
+static void gltf_write_matrix(FILE *fg, const float *t) {
+    static const float identity[16] = {1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1};
+    if (!t || !memcmp(t, identity, sizeof(identity))) return;
+    fprintf(fg, ", \"matrix\": [");
+    for (int k = 0; k < 16; k++) fprintf(fg, "%s%.9g", k ? ", " : "", (double) t[k]);
+    fprintf(fg, "]");
+}
+
+bool topo_export_gltf_ex(const TopoScene *scene, const char *outGltfPath, const TopoExportOptions *opt,
+                         TopoExportStats *stats, TopoError *err) {
+    const int count = scene->count;
+    const int lods = (opt && opt->lod_count > 0) ? opt->lod_count : 0;
+    const float lodRatio = (opt && opt->lod_ratio > 0.0f && opt->lod_ratio < 1.0f) ? opt->lod_ratio : 0.5f;
+    // without instances all meshes are concatenated into one glTF mesh placed by one node; with
+    // them every scene mesh becomes a glTF mesh and every instance a node referencing it
+    const bool inst = scene->instanceCount > 0;
+    const int groups = inst ? count : 1;
+    const int nodes = inst ? scene->instanceCount : 1;
+    const int per = lods + 1;
+    // normals are written only when every mesh carries them
+    bool hasN = count > 0;
+    for (int i = 0; i < count; i++)
+        if (!scene->meshes[i].normals && scene->meshes[i].vCount) hasN = false;
+
+    // TopoMesh storage is laid out exactly like Vector3/Quad, so the scene is viewed as QMeshes
+    // without copying; LODs simplify private copies
+    QMesh *work = (QMesh *) calloc((size_t) (count > 0 ? count : 1), sizeof(QMesh));
+    float **normals = (float **) calloc((size_t) (count > 0 ? count : 1), sizeof(float *));
+    for (int i = 0; i < count; i++) {
+        const TopoMesh *m = &scene->meshes[i];
+        work[i].v = (Vector3 *) m->vertices;
+        work[i].vCount = m->vCount;
+        work[i].q = (Quad *) m->quads;
+        work[i].qCount = m->qCount;
+        normals[i] = m->normals;
+    }
+    // level l of group g is glTF mesh g * per + l
+    const int levelCount = groups * per;
+    GltfLevel *levels = (GltfLevel *) calloc((size_t) levelCount, sizeof(GltfLevel));
+    for (int g = 0; g < groups; g++)
+        gltf_level_build(&levels[g * per], work + (inst ? g : 0), normals + (inst ? g : 0), inst ? 1 : count, hasN);
+    for (int i = 0; i < count; i++) {
+        const TopoMesh *m = &scene->meshes[i];
+        qm_init(&work[i]);
+        if (lods == 0) continue;
+        qm_addv_n(&work[i], (const Vector3 *) m->vertices, m->vCount);
+        qm_addq_n(&work[i], (const Quad *) m->quads, m->qCount);
+    }
+    for (int l = 1; l <= lods; l++) {
+        for (int i = 0; i < count; i++) {
+            mesh_simplify(&work[i], lodRatio, INFINITY, NULL, NULL);
+            normals[i] = hasN ? mesh_vertex_normals(&work[i], 0.0f, NULL, NULL) : NULL;
+        }
+        for (int g = 0; g < groups; g++)
+            gltf_level_build(&levels[g * per + l], work + (inst ? g : 0), normals + (inst ? g : 0),
+                             inst ? 1 : count, hasN);
+        for (int i = 0; i < count; i++) free(normals[i]);
+    }
+    for (int i = 0; i < count; i++) qm_free(&work[i]);
+    free(work);
+    free(normals);
+
+    if (opt && opt->spatial_order)
+        for (int l = 0; l < levelCount; l++) gltf_level_spatial(&levels[l]);
+
+    // ACMR over the full-detail levels, weighted by triangle count
+    double missBefore = 0.0, missAfter = 0.0, tris = 0.0;
+    for (int g = 0; g < groups; g++) {
+        const GltfLevel *L = &levels[g * per];
+        missBefore += (double) mesh_acmr(L->idx, L->iCount, L->vCount, GLTF_CACHE_SIZE) * (L->iCount / 3);
+        tris += L->iCount / 3;
+    }
+    missAfter = missBefore;
+    if (opt && opt->optimize) {
+        for (int l = 0; l < levelCount; l++) gltf_level_optimize(&levels[l]);
+        missAfter = 0.0;
+        for (int g = 0; g < groups; g++) {
+            const GltfLevel *L = &levels[g * per];
+            missAfter += (double) mesh_acmr(L->idx, L->iCount, L->vCount, GLTF_CACHE_SIZE) * (L->iCount / 3);
+        }
+    }
+    if (stats) {
+        stats->acmr_before = tris > 0.0 ? (float) (missBefore / tris) : 0.0f;
+        stats->acmr_after = tris > 0.0 ? (float) (missAfter / tris) : 0.0f;
     }
 
     char binPath[512];
@@ -59,42 +172,131 @@ bool topo_export_gltf(const TopoScene *scene, const char *outGltfPath, TopoError
             err->col = 0;
             strcpy(err->msg, "can't write bin");
         }
+        for (int l = 0; l < levelCount; l++) gltf_level_free(&levels[l]);
+        free(levels);
         return false;
     }
-    size_t byteV = sizeof(float) * 3 * totalV;
-    size_t byteI = sizeof(unsigned int) * totalI;
-    fwrite(all.v, 1, byteV, fb);
-    fwrite(all.idx, 1, byteI, fb);
+    size_t byteTotal = 0;
+    for (int l = 0; l < levelCount; l++) {
+        const GltfLevel *L = &levels[l];
+        size_t byteV = sizeof(float) * 3 * (size_t) L->vCount;
+        fwrite(L->v, 1, byteV, fb);
+        if (L->n) fwrite(L->n, 1, byteV, fb);
+        fwrite(L->idx, 1, sizeof(unsigned) * (size_t) L->iCount, fb);
+        byteTotal += byteV * (L->n ? 2 : 1) + sizeof(unsigned) * (size_t) L->iCount;
+    }
     fclose(fb);
 
     FILE *fg = fopen(outGltfPath, "wb");
     if (!fg) {
         if (err) { strcpy(err->msg, "can't write gltf"); }
+        for (int l = 0; l < levelCount; l++) gltf_level_free(&levels[l]);
+        free(levels);
         return false;
     }
+    // LOD levels that simplified away are left out: glTF forbids zero-count accessors. meshId[l]
+    // is the glTF mesh of level l or -1; full-detail levels are always written
+    int *meshId = (int *) malloc(sizeof(int) * (size_t) levelCount);
+    int meshCount = 0;
+    for (int l = 0; l < levelCount; l++) meshId[l] = (l % per == 0 || levels[l].iCount > 0) ? meshCount++ : -1;
+    // node roots[p] is placement p; its kept LOD nodes follow it
+    int *roots = (int *) malloc(sizeof(int) * (size_t) (nodes > 0 ? nodes : 1));
+    int nodeCount = 0;
+    for (int p = 0; p < nodes; p++) {
+        const int g = inst ? scene->instances[p].mesh : 0;
+        roots[p] = nodeCount;
+        for (int l = 0; l <= lods; l++) nodeCount += meshId[g * per + l] >= 0;
+    }
+    const bool anyLod = meshCount > groups;
+    // per level, one buffer view and one accessor each for positions, [normals], indices;
+    // accessor i reads buffer view i
+    const int perLevel = hasN ? 3 : 2;
+    const int last = meshCount - 1;
     fprintf(fg,
             "{\n"
-            "  \"asset\": {\"version\": \"2.0\"},\n"
+            "  \"asset\": {\"version\": \"2.0\"},\n");
+    if (anyLod) fprintf(fg, "  \"extensionsUsed\": [\"MSFT_lod\"],\n");
+    fprintf(fg,
             "  \"buffers\": [ {\"uri\": \"%s.bin\", \"byteLength\": %zu} ],\n"
-            "  \"bufferViews\": [\n"
-            "    {\"buffer\":0, \"byteOffset\":0, \"byteLength\": %zu, \"target\":34962},\n"
-            "    {\"buffer\":0, \"byteOffset\":%zu, \"byteLength\": %zu, \"target\":34963}\n"
+            "  \"bufferViews\": [\n",
+            outGltfPath, byteTotal);
+    size_t off = 0;
+    for (int l = 0; l < levelCount; l++) {
+        const GltfLevel *L = &levels[l];
+        if (meshId[l] < 0) continue;
+        size_t byteV = sizeof(float) * 3 * (size_t) L->vCount, byteI = sizeof(unsigned) * (size_t) L->iCount;
+        fprintf(fg, "    {\"buffer\":0, \"byteOffset\":%zu, \"byteLength\": %zu, \"target\":34962},\n", off, byteV);
+        off += byteV;
+        if (L->n) {
+            fprintf(fg, "    {\"buffer\":0, \"byteOffset\":%zu, \"byteLength\": %zu, \"target\":34962},\n", off, byteV);
+            off += byteV;
+        }
+        fprintf(fg, "    {\"buffer\":0, \"byteOffset\":%zu, \"byteLength\": %zu, \"target\":34963}%s\n",
+                off, byteI, meshId[l] < last ? "," : "");
+        off += byteI;
+    }
+    fprintf(fg,
             "  ],\n"
-            "  \"accessors\": [\n"
-            "    {\"bufferView\":0, \"componentType\":5126, \"count\": %d, \"type\":\"VEC3\"},\n"
-            "    {\"bufferView\":1, \"componentType\":5125, \"count\": %d, \"type\":\"SCALAR\"}\n"
+            "  \"accessors\": [\n");
+    for (int l = 0; l < levelCount; l++) {
+        const GltfLevel *L = &levels[l];
+        if (meshId[l] < 0) continue;
+        int base = meshId[l] * perLevel;
+        fprintf(fg, "    {\"bufferView\":%d, \"componentType\":5126, \"count\": %d, \"type\":\"VEC3\"},\n",
+                base, L->vCount);
+        if (L->n)
+            fprintf(fg, "    {\"bufferView\":%d, \"componentType\":5126, \"count\": %d, \"type\":\"VEC3\"},\n",
+                    base + 1, L->vCount);
+        fprintf(fg, "    {\"bufferView\":%d, \"componentType\":5125, \"count\": %d, \"type\":\"SCALAR\"}%s\n",
+                base + perLevel - 1, L->iCount, meshId[l] < last ? "," : "");
+    }
+    fprintf(fg,
+            "  ],\n"
+            "  \"meshes\": [\n");
+    for (int l = 0; l < levelCount; l++) {
+        if (meshId[l] < 0) continue;
+        int base = meshId[l] * perLevel;
+        if (hasN)
+            fprintf(fg, "    {\"primitives\": [ {\"attributes\": {\"POSITION\":%d, \"NORMAL\":%d}, \"indices\":%d} ]}%s\n",
+                    base, base + 1, base + 2, meshId[l] < last ? "," : "");
+        else
+            fprintf(fg, "    {\"primitives\": [ {\"attributes\": {\"POSITION\":%d}, \"indices\":%d} ]}%s\n",
+                    base, base + 1, meshId[l] < last ? "," : "");
+    }
+    // LOD nodes follow their placement's node, carry the same matrix and hang off it through
+    // MSFT_lod rather than being scene roots
+    fprintf(fg,
             "  ],\n"
-            "  \"meshes\": [ {\"primitives\": [ {\"attributes\": {\"POSITION\":0}, \"indices\":1} ]} ],\n"
-            "  \"nodes\": [ {\"mesh\":0} ],\n"
-            "  \"scenes\": [ {\"nodes\": [0]} ],\n"
+            "  \"nodes\": [\n");
+    for (int p = 0; p < nodes; p++) {
+        const int g = inst ? scene->instances[p].mesh : 0;
+        const float *t = inst ? scene->instances[p].transform : NULL;
+        const int kept = (p + 1 < nodes ? roots[p + 1] : nodeCount) - roots[p];
+        for (int l = 0, id = roots[p]; l <= lods; l++) {
+            if (meshId[g * per + l] < 0) continue;
+            fprintf(fg, "    {\"mesh\":%d", meshId[g * per + l]);
+            gltf_write_matrix(fg, t);
+            if (l == 0 && kept > 1) {
+                fprintf(fg, ", \"extensions\": {\"MSFT_lod\": {\"ids\": [");
+                for (int k = 1; k < kept; k++) fprintf(fg, "%s%d", k > 1 ? ", " : "", id + k);
+                fprintf(fg, "]}}");
+            }
+            fprintf(fg, "}%s\n", id < nodeCount - 1 ? "," : "");
+            id++;
+        }
+    }
+    fprintf(fg,
+            "  ],\n"
+            "  \"scenes\": [ {\"nodes\": [");
+    for (int p = 0; p < nodes; p++) fprintf(fg, "%s%d", p ? ", " : "", roots[p]);
+    fprintf(fg,
+            "]} ],\n"
             "  \"scene\": 0\n"
-            "}\n",
-            outGltfPath, (size_t) (byteV + byteI),
-            byteV, byteV, byteI,
-            totalV, totalI
-    );
+            "}\n");
     fclose(fg);
-    free(all.v);
-    free(all.idx);
+    free(meshId);
+    free(roots);
+    for (int l = 0; l < levelCount; l++) gltf_level_free(&levels[l]);
+    free(levels);
     return true;
 }
@@ -2,13 +2,14 @@
 #include "util.h"
 #include <string.h>
 #include <stdio.h>
+#include <stdalign.h>
 
+// Mesh growth copies old contents itself (see QAllocator), so p is always NULL here.
 static void *arena_realloc(void *ud, void *p, size_t sz, size_t align) {
     Host *H = (Host *) ud;
-    if (sz == 0) return p;
-    void *np = arena_alloc(H->arena, sz, align);
-    if (p && np) memcpy(np, p, sz);
-    return np;
+    (void) p;
+    if (sz == 0) return NULL;
+    return arena_alloc(H->arena, sz, align);
 }
 
 static void arena_free(void *ud, void *p) {
@@ -50,6 +51,22 @@ static Value VRingV(QRing *r) {
     return v;
 }
 
+static Value VBBox(float *bb) {
+    Value v;
+    memset(&v, 0, sizeof(v));
+    v.k = VAL_BBOX;
+    v.bbox = bb;
+    return v;
+}
+
+static Value VSdf(const QSdf *sdf) {
+    Value v;
+    memset(&v, 0, sizeof(v));
+    v.k = VAL_SDF;
+    v.sdf = sdf;
+    return v;
+}
+
 static Value VRingListPtrs(QRing **p, int n) {
     Value v;
     memset(&v, 0, sizeof(v));
@@ -78,6 +95,17 @@ static QMesh *ensure_builder(Host *H) {
     return H->build;
 }
 
+static QMesh *new_mesh(Host *H) {
+    QMesh *m = (QMesh *) arena_alloc(H->arena, sizeof(QMesh), 8);
+    qm_init(m);
+    return m;
+}
+
+static bool all_num(const Value *a, int n) {
+    for (int i = 0; i < n; i++) if (a[i].k != VAL_NUMBER) return false;
+    return true;
+}
+
 static Value bi_ring(Host *H, Value *args, int argc, char err[256]) {
     if (argc < 5) {
         strcpy(err, "ring(cx,cy,rx,ry,segments)");
@@ -85,7 +113,23 @@ static Value bi_ring(Host *H, Value *args, int argc, char err[256]) {
     }
     QMesh *b = ensure_builder(H);
     QRing *r = (QRing *) arena_alloc(H->arena, sizeof(QRing), 8);
-    *r = ring_ellipse(b, (float) ARGNUM(0), (float) ARGNUM(1), (float) ARGNUM(2), (float) ARGNUM(3), (int) ARGNUM(4));
+    *r = ring_ellipse_cached(b, H->tpl, (float) ARGNUM(0), (float) ARGNUM(1), (float) ARGNUM(2), (float) ARGNUM(3), (int) ARGNUM(4));
+    return VRingV(r);
+}
+
+static Value bi_polyline(Host *H, Value *args, int argc, char err[256]) {
+    if (argc < 6 || argc % 3 != 0 || !all_num(args, argc)) {
+        strcpy(err, "polyline(x0,y0,z0, x1,y1,z1, ...)");
+        return VVoid();
+    }
+    QMesh *b = ensure_builder(H);
+    int n = argc / 3;
+    QRing *r = (QRing *) arena_alloc(H->arena, sizeof(QRing), 8);
+    *r = qr_new_with_alloc(b->alloc);
+    qr_reserve(r, n);
+    qm_reserve(b, b->vCount + n, 0);
+    for (int i = 0; i < n; i++)
+        qr_push(r, qm_addv(b, (Vector3) {(float) ARGNUM(i * 3), (float) ARGNUM(i * 3 + 1), (float) ARGNUM(i * 3 + 2)}));
     return VRingV(r);
 }
 
@@ -107,6 +151,7 @@ static QRing *clone_ring_on_builder(Host *H, const QRing *src) {
     out->cap = src->count;
     out->alloc = (QAllocator) {0};
     out->idx = (int *) arena_alloc(H->arena, sizeof(int) * (size_t) src->count, 4);
+    qm_reserve(b, b->vCount + src->count, 0);
     for (int k = 0; k < src->count; k++) {
         int old = src->idx[k];
         int neu = qm_addv(b, b->v[old]);
@@ -129,6 +174,7 @@ static Value bi_lift_x(Host *H, Value *args, int argc, char err[256]) {
     dst->cap = src->count;
     dst->alloc = (QAllocator) {0};
     dst->idx = (int *) arena_alloc(H->arena, sizeof(int) * (size_t) src->count, 4);
+    qm_reserve(b, b->vCount + src->count, 0);
 
     for (int i = 0; i < src->count; i++) {
         int oi = src->idx[i];
@@ -154,6 +200,7 @@ static Value bi_lift_y(Host *H, Value *args, int argc, char err[256]) {
     dst->cap = src->count;
     dst->alloc = (QAllocator) {0};
     dst->idx = (int *) arena_alloc(H->arena, sizeof(int) * (size_t) src->count, 4);
+    qm_reserve(b, b->vCount + src->count, 0);
 
     for (int i = 0; i < src->count; i++) {
         int oi = src->idx[i];
@@ -179,6 +226,7 @@ static Value bi_lift_z(Host *H, Value *args, int argc, char err[256]) {
     dst->cap = src->count;
     dst->alloc = (QAllocator) {0};
     dst->idx = (int *) arena_alloc(H->arena, sizeof(int) * (size_t) src->count, 4);
+    qm_reserve(b, b->vCount + src->count, 0);
 
     for (int i = 0; i < src->count; i++) {
         int oi = src->idx[i];
@@ -199,7 +247,197 @@ static Value bi_weld(Host *H, Value *args, int argc, char err[256]) {
     QMesh *m = (QMesh *) arena_alloc(H->arena, sizeof(QMesh), 8);
     qm_init(m);
     mesh_merge(m, args[0].mesh);
-    mesh_weld_by_distance(m, (float) eps);
+    size_t mark = arena_mark(H->arena);
+    mesh_share_refs(m, host_alloc_trampoline, H);
+    mesh_weld_by_distance_ex(m, (float) eps, host_alloc_trampoline, H);
+    arena_release(H->arena, mark);
+    return VMes(m);
+}
+
+static Value bi_compact(Host *H, Value *args, int argc, char err[256]) {
+    if (argc != 1 || args[0].k != VAL_MESH) {
+        strcpy(err, "compact(mesh)");
+        return VVoid();
+    }
+    QMesh *m = (QMesh *) arena_alloc(H->arena, sizeof(QMesh), 8);
+    qm_init(m);
+    mesh_merge(m, args[0].mesh);
+    size_t mark = arena_mark(H->arena);
+    mesh_compact(m, host_alloc_trampoline, H);
+    arena_release(H->arena, mark);
+    return VMes(m);
+}
+
+static Value bi_reorder_spatial(Host *H, Value *args, int argc, char err[256]) {
+    if (argc != 1 || args[0].k != VAL_MESH) {
+        strcpy(err, "reorder_spatial(mesh)");
+        return VVoid();
+    }
+    QMesh *m = new_mesh(H);
+    mesh_merge(m, args[0].mesh);
+    size_t mark = arena_mark(H->arena);
+    mesh_reorder_spatial(m, host_alloc_trampoline, H);
+    arena_release(H->arena, mark);
+    return VMes(m);
+}
+
+static Value bi_subdivide(Host *H, Value *args, int argc, char err[256]) {
+    if (argc < 1 || argc > 2 || args[0].k != VAL_MESH) {
+        strcpy(err, "subdivide(mesh, levels=1)");
+        return VVoid();
+    }
+    int levels = (argc >= 2) ? (int) ARGNUM(1) : 1;
+    if (levels < 0 || levels > 8) {
+        strcpy(err, "subdivide: levels must be 0..8");
+        return VVoid();
+    }
+    QMesh *m = (QMesh *) arena_alloc(H->arena, sizeof(QMesh), 8);
+    qm_init(m);
+    mesh_merge(m, args[0].mesh);
+    // pieces cut from the builder only become one surface once their shared vertices are merged
+    size_t mark = arena_mark(H->arena);
+    mesh_share_refs(m, host_alloc_trampoline, H);
+    arena_release(H->arena, mark);
+    mesh_subdivide(m, levels);
+    return VMes(m);
+}
+
+static Value bi_simplify(Host *H, Value *args, int argc, char err[256]) {
+    if (argc < 2 || argc > 3 || args[0].k != VAL_MESH || args[1].k != VAL_NUMBER) {
+        strcpy(err, "simplify(mesh, ratio, max_error)");
+        return VVoid();
+    }
+    float ratio = (float) ARGNUM(1);
+    float maxError = (argc >= 3) ? (float) ARGNUM(2) : INFINITY;
+    if (ratio < 0.0f || ratio > 1.0f) {
+        strcpy(err, "simplify: ratio must be 0..1");
+        return VVoid();
+    }
+    if (maxError < 0.0f) {
+        strcpy(err, "simplify: max_error must be >= 0");
+        return VVoid();
+    }
+    QMesh *m = (QMesh *) arena_alloc(H->arena, sizeof(QMesh), 8);
+    qm_init(m);
+    mesh_merge(m, args[0].mesh);
+    size_t mark = arena_mark(H->arena);
+    mesh_share_refs(m, host_alloc_trampoline, H);
+    arena_release(H->arena, mark);
+    mark = arena_mark(H->arena);
+    mesh_simplify(m, ratio, maxError, host_alloc_trampoline, H);
+    arena_release(H->arena, mark);
+    return VMes(m);
+}
+
+static Value bi_box(Host *H, Value *args, int argc, char err[256]) {
+    if (argc < 3 || argc > 4 || !all_num(args, argc)) {
+        strcpy(err, "box(sx,sy,sz, segs=1)");
+        return VVoid();
+    }
+    int segs = (argc >= 4) ? (int) ARGNUM(3) : 1;
+    if (segs < 1 || segs > 1024) {
+        strcpy(err, "box: segs must be 1..1024");
+        return VVoid();
+    }
+    QMesh *m = new_mesh(H);
+    mesh_box(m, (float) ARGNUM(0), (float) ARGNUM(1), (float) ARGNUM(2), segs);
+    return VMes(m);
+}
+
+static Value bi_cylinder(Host *H, Value *args, int argc, char err[256]) {
+    if (argc < 2 || argc > 5 || !all_num(args, argc)) {
+        strcpy(err, "cylinder(len, r, segs=24, caps=1, rings=1)");
+        return VVoid();
+    }
+    int segs = (argc >= 3) ? (int) ARGNUM(2) : 24;
+    bool caps = (argc >= 4) ? ARGNUM(3) != 0.0 : true;
+    int rings = (argc >= 5) ? (int) ARGNUM(4) : 1;
+    if (segs < 3 || segs > 1024 || rings < 1 || rings > 1024) {
+        strcpy(err, "cylinder: needs segs 3..1024 and rings 1..1024");
+        return VVoid();
+    }
+    QMesh *m = new_mesh(H);
+    mesh_cylinder(m, (float) ARGNUM(1), (float) ARGNUM(0), segs, rings, caps);
+    return VMes(m);
+}
+
+static Value bi_tube(Host *H, Value *args, int argc, char err[256]) {
+    if (argc < 3 || argc > 5 || !all_num(args, argc)) {
+        strcpy(err, "tube(len, r_outer, r_inner, segs=24, caps=1)");
+        return VVoid();
+    }
+    int segs = (argc >= 4) ? (int) ARGNUM(3) : 24;
+    bool caps = (argc >= 5) ? ARGNUM(4) != 0.0 : true;
+    if (segs < 3 || segs > 1024) {
+        strcpy(err, "tube: segs must be 3..1024");
+        return VVoid();
+    }
+    if (!(ARGNUM(2) < ARGNUM(1))) {
+        strcpy(err, "tube: r_inner must be less than r_outer");
+        return VVoid();
+    }
+    QMesh *m = new_mesh(H);
+    mesh_tube(m, (float) ARGNUM(1), (float) ARGNUM(2), (float) ARGNUM(0), segs, caps);
+    return VMes(m);
+}
+
+static Value bi_sphere(Host *H, Value *args, int argc, char err[256]) {
+    if (argc < 1 || argc > 2 || !all_num(args, argc)) {
+        strcpy(err, "sphere(r, segs=8)");
+        return VVoid();
+    }
+    int segs = (argc >= 2) ? (int) ARGNUM(1) : 8;
+    if (segs < 1 || segs > 1024) {
+        strcpy(err, "sphere: segs must be 1..1024");
+        return VVoid();
+    }
+    QMesh *m = new_mesh(H);
+    mesh_sphere(m, (float) ARGNUM(0), segs);
+    return VMes(m);
+}
+
+static Value bi_torus(Host *H, Value *args, int argc, char err[256]) {
+    if (argc < 2 || argc > 4 || !all_num(args, argc)) {
+        strcpy(err, "torus(R, r, segs=32, sides=16)");
+        return VVoid();
+    }
+    int segs = (argc >= 3) ? (int) ARGNUM(2) : 32;
+    int sides = (argc >= 4) ? (int) ARGNUM(3) : 16;
+    if (segs < 3 || segs > 1024 || sides < 3 || sides > 1024) {
+        strcpy(err, "torus: needs segs and sides 3..1024");
+        return VVoid();
+    }
+    QMesh *m = new_mesh(H);
+    mesh_torus(m, (float) ARGNUM(0), (float) ARGNUM(1), segs, sides);
+    return VMes(m);
+}
+
+static Value bi_sweep(Host *H, Value *args, int argc, char err[256]) {
+    if (argc < 2 || argc > 5 || args[0].k != VAL_RING || args[1].k != VAL_RING || !all_num(args + 2, argc - 2)) {
+        strcpy(err, "sweep(profile_ring, path_ring, twist=0, scale=1, caps=1)");
+        return VVoid();
+    }
+    const QRing *prof = args[0].ring, *path = args[1].ring;
+    if (prof->count < 3 || path->count < 2) {
+        strcpy(err, "sweep: profile needs 3+ points and path 2+");
+        return VVoid();
+    }
+    float twist = (argc >= 3) ? (float) ARGNUM(2) : 0.0f;
+    float scale = (argc >= 4) ? (float) ARGNUM(3) : 1.0f;
+    bool caps = (argc >= 5) ? ARGNUM(4) != 0.0 : true;
+    QMesh *b = ensure_builder(H);
+    QMesh *m = new_mesh(H);
+    size_t mark = arena_mark(H->arena);
+    Vector3 *pp = (Vector3 *) arena_alloc(H->arena, sizeof(Vector3) * (size_t) (prof->count + path->count), alignof(Vector3));
+    Vector3 *pa = pp + prof->count;
+    for (int i = 0; i < prof->count; i++) pp[i] = b->v[prof->idx[i]];
+    for (int i = 0; i < path->count; i++) pa[i] = b->v[path->idx[i]];
+    mesh_sweep(m, pp, prof->count, pa, path->count, twist, scale, caps);
+    arena_release(H->arena, mark);
+    if (m->vCount == 0) {
+        strcpy(err, "sweep: path needs 2+ distinct points");
+        return VVoid();
+    }
     return VMes(m);
 }
 
@@ -209,7 +447,7 @@ static Value bi_cap_plane(Host *H, Value *args, int argc, char err[256]) {
         return VVoid();
     }
     QMesh *b = ensure_builder(H);
-    QMesh *cap = cap_plane_build(b, args[0].ring, host_alloc_trampoline, H);
+    QMesh *cap = cap_plane_build_cached(b, H->tpl, args[0].ring, host_alloc_trampoline, H);
     return VMes(cap);
 }
 
@@ -228,6 +466,12 @@ static Value bi_stitch(Host *H, Value *args, int argc, char err[256]) {
 
         QRing **src = args[0].ringlist.ptrs;
         QRing *remap = (QRing *) arena_alloc(H->arena, sizeof(QRing) * (size_t) n, 8);
+        int vTotal = 0, qTotal = 0;
+        for (int i = 0; i < n; i++) {
+            vTotal += src[i]->count;
+            if (i > 0 && src[i]->count == src[i - 1]->count) qTotal += src[i]->count;
+        }
+        qm_reserve(m, vTotal, qTotal);
 
         for (int i = 0; i < n; i++) {
             remap[i].count = src[i]->count;
@@ -236,7 +480,7 @@ static Value bi_stitch(Host *H, Value *args, int argc, char err[256]) {
             remap[i].idx = (int *) arena_alloc(H->arena, sizeof(int) * (size_t) src[i]->count, 4);
             for (int k = 0; k < src[i]->count; k++) {
                 int old = src[i]->idx[k];
-                int neu = qm_addv(m, b->v[old]);
+                int neu = qm_addv_ref(m, b, old);
                 remap[i].idx[k] = neu;
             }
         }
@@ -251,6 +495,7 @@ static Value bi_stitch(Host *H, Value *args, int argc, char err[256]) {
 
         const QRing *a = args[0].ring;
         const QRing *bR = args[1].ring;
+        qm_reserve(m, a->count + bR->count, a->count == bR->count ? a->count : 0);
 
         QRing A, B;
         A.count = a->count;
@@ -265,12 +510,12 @@ static Value bi_stitch(Host *H, Value *args, int argc, char err[256]) {
 
         for (int k = 0; k < a->count; k++) {
             int old = a->idx[k];
-            int neu = qm_addv(m, b->v[old]);
+            int neu = qm_addv_ref(m, b, old);
             A.idx[k] = neu;
         }
         for (int k = 0; k < bR->count; k++) {
             int old = bR->idx[k];
-            int neu = qm_addv(m, b->v[old]);
+            int neu = qm_addv_ref(m, b, old);
             B.idx[k] = neu;
         }
 
@@ -282,6 +527,26 @@ static Value bi_stitch(Host *H, Value *args, int argc, char err[256]) {
     return VVoid();
 }
 
+// Merges the mesh arguments into a new mesh. Once any of them is instanced the result stays
+// symbolic, and plain meshes join it as identity placements instead of being copied.
+static QMesh *merge_args(Host *H, const Value *args, int argc) {
+    QMesh *m = new_mesh(H);
+    bool instanced = false;
+    for (int i = 0; i < argc; i++) if (args[i].k == VAL_MESH) instanced |= args[i].mesh->instCount > 0;
+    if (instanced) {
+        Matrix I = MatrixIdentity();
+        for (int i = 0; i < argc; i++) if (args[i].k == VAL_MESH) mesh_instance(m, args[i].mesh, &I);
+        return m;
+    }
+    size_t mark = arena_mark(H->arena);
+    const QMesh **src = (const QMesh **) arena_alloc(H->arena, sizeof(QMesh *) * (size_t) argc, alignof(QMesh *));
+    int n = 0;
+    for (int i = 0; i < argc; i++) if (args[i].k == VAL_MESH) src[n++] = args[i].mesh;
+    mesh_merge_n(m, src, n);
+    arena_release(H->arena, mark);
+    return m;
+}
+
 static Value bi_merge(Host *H, Value *args, int argc, char err[256]) {
     for (int i = 0; i < argc; i++) {
         if (args[i].k != VAL_MESH) {
@@ -289,9 +554,23 @@ static Value bi_merge(Host *H, Value *args, int argc, char err[256]) {
             return VVoid();
         }
     }
-    QMesh *m = (QMesh *) arena_alloc(H->arena, sizeof(QMesh), 8);
-    qm_init(m);
-    for (int i = 0; i < argc; i++) mesh_merge(m, args[i].mesh);
+    return VMes(merge_args(H, args, argc));
+}
+
+static Value bi_merge_weld(Host *H, Value *args, int argc, char err[256]) {
+    bool ok = argc >= 2 && args[0].k == VAL_NUMBER && args[0].num >= 0.0;
+    for (int i = 1; ok && i < argc; i++) ok = args[i].k == VAL_MESH;
+    if (!ok) {
+        strcpy(err, "merge_weld(eps, mesh, ...)");
+        return VVoid();
+    }
+    QMesh *m = new_mesh(H);
+    size_t mark = arena_mark(H->arena);
+    const QMesh **src = (const QMesh **) arena_alloc(H->arena, sizeof(QMesh *) * (size_t) (argc - 1), alignof(QMesh *));
+    for (int i = 1; i < argc; i++) src[i - 1] = args[i].mesh;
+    mesh_merge_weld(m, src, argc - 1, (float) ARGNUM(0), host_alloc_trampoline, H);
+    mesh_share_refs(m, host_alloc_trampoline, H);
+    arena_release(H->arena, mark);
     return VMes(m);
 }
 
@@ -300,10 +579,9 @@ static Value bi_rotate_x(Host *H, Value *args, int argc, char err[256]) {
         strcpy(err, "rotate_x(mesh, rad)");
         return VVoid();
     }
-    QMesh *m = (QMesh *) arena_alloc(H->arena, sizeof(QMesh), 8);
-    qm_init(m);
-    mesh_merge(m, args[0].mesh);
-    mesh_rotate_x(m, (float) ARGNUM(1));
+    QMesh *m = new_mesh(H);
+    Matrix M = MatrixRotateX((float) ARGNUM(1));
+    mesh_instance(m, args[0].mesh, &M);
     return VMes(m);
 }
 
@@ -312,10 +590,9 @@ static Value bi_rotate_y(Host *H, Value *args, int argc, char err[256]) {
         strcpy(err, "rotate_y(mesh, rad)");
         return VVoid();
     }
-    QMesh *m = (QMesh *) arena_alloc(H->arena, sizeof(QMesh), 8);
-    qm_init(m);
-    mesh_merge(m, args[0].mesh);
-    mesh_rotate_y(m, (float) ARGNUM(1));
+    QMesh *m = new_mesh(H);
+    Matrix M = MatrixRotateY((float) ARGNUM(1));
+    mesh_instance(m, args[0].mesh, &M);
     return VMes(m);
 }
 
@@ -324,10 +601,9 @@ static Value bi_rotate_z(Host *H, Value *args, int argc, char err[256]) {
         strcpy(err, "rotate_z(mesh, rad)");
         return VVoid();
     }
-    QMesh *m = (QMesh *) arena_alloc(H->arena, sizeof(QMesh), 8);
-    qm_init(m);
-    mesh_merge(m, args[0].mesh);
-    mesh_rotate_z(m, (float) ARGNUM(1));
+    QMesh *m = new_mesh(H);
+    Matrix M = MatrixRotateZ((float) ARGNUM(1));
+    mesh_instance(m, args[0].mesh, &M);
     return VMes(m);
 }
 
@@ -375,10 +651,9 @@ static Value bi_move(Host *H, Value *args, int argc, char err[256]) {
         strcpy(err, "move(mesh,dx,dy,dz)");
         return VVoid();
     }
-    QMesh *m = (QMesh *) arena_alloc(H->arena, sizeof(QMesh), 8);
-    qm_init(m);
-    mesh_merge(m, args[0].mesh);
-    mesh_move(m, (float) ARGNUM(1), (float) ARGNUM(2), (float) ARGNUM(3));
+    QMesh *m = new_mesh(H);
+    Matrix M = MatrixTranslate((float) ARGNUM(1), (float) ARGNUM(2), (float) ARGNUM(3));
+    mesh_instance(m, args[0].mesh, &M);
     return VMes(m);
 }
 
@@ -387,10 +662,92 @@ static Value bi_scale(Host *H, Value *args, int argc, char err[256]) {
         strcpy(err, "scale(mesh,sx,sy,sz)");
         return VVoid();
     }
-    QMesh *m = (QMesh *) arena_alloc(H->arena, sizeof(QMesh), 8);
-    qm_init(m);
-    mesh_merge(m, args[0].mesh);
-    mesh_scale(m, (float) ARGNUM(1), (float) ARGNUM(2), (float) ARGNUM(3));
+    QMesh *m = new_mesh(H);
+    const float sx = (float) ARGNUM(1), sy = (float) ARGNUM(2), sz = (float) ARGNUM(3);
+    // scale() has always kept the winding as is, while a placement with a negative determinant
+    // reverses it on flattening; a mirroring scale therefore scales a flat copy
+    if (sx * sy * sz < 0.0f) {
+        mesh_merge(m, args[0].mesh);
+        mesh_scale(m, sx, sy, sz);
+        return VMes(m);
+    }
+    Matrix M = MatrixScale(sx, sy, sz);
+    mesh_instance(m, args[0].mesh, &M);
+    return VMes(m);
+}
+
+static Value bi_transform(Host *H, Value *args, int argc, char err[256]) {
+    if (argc < 1 || argc > 11 || args[0].k != VAL_MESH) {
+        strcpy(err, "transform(mesh, dx,dy,dz, ax,ay,az, angle, sx,sy,sz)");
+        return VVoid();
+    }
+    double p[10] = {0, 0, 0, 0, 0, 1, 0, 1, 1, 1};
+    for (int i = 1; i < argc; i++) {
+        if (args[i].k != VAL_NUMBER) {
+            strcpy(err, "transform: numeric arguments expected");
+            return VVoid();
+        }
+        p[i - 1] = ARGNUM(i);
+    }
+    // scale, then rotate about the axis, then translate
+    Matrix M = MatrixScale((float) p[7], (float) p[8], (float) p[9]);
+    Vector3 axis = (Vector3) {(float) p[3], (float) p[4], (float) p[5]};
+    if (p[6] != 0.0 && Vector3Length(axis) > 0.0f) M = MatrixMultiply(M, MatrixRotate(axis, (float) p[6]));
+    M = MatrixMultiply(M, MatrixTranslate((float) p[0], (float) p[1], (float) p[2]));
+
+    QMesh *m = new_mesh(H);
+    mesh_instance(m, args[0].mesh, &M);
+    return VMes(m);
+}
+
+#define REPLICATE_MAX 1000000
+
+static Value bi_array(Host *H, Value *args, int argc, char err[256]) {
+    if (argc != 5 || args[0].k != VAL_MESH || !all_num(args + 1, 4)) {
+        strcpy(err, "array(mesh, count, dx,dy,dz)");
+        return VVoid();
+    }
+    double count = ARGNUM(1);
+    if (count < 0 || count > REPLICATE_MAX) {
+        strcpy(err, "array: count must be 0..1000000");
+        return VVoid();
+    }
+    int n = (int) count;
+    QMesh *m = new_mesh(H);
+    size_t mark = arena_mark(H->arena);
+    Vector3 *off = (Vector3 *) arena_alloc(H->arena, sizeof(Vector3) * (size_t) (n > 0 ? n : 1), alignof(Vector3));
+    const float dx = (float) ARGNUM(2), dy = (float) ARGNUM(3), dz = (float) ARGNUM(4);
+    // multiplied rather than accumulated, so copy i sits exactly at i * step
+    for (int i = 0; i < n; i++) off[i] = (Vector3) {dx * (float) i, dy * (float) i, dz * (float) i};
+    mesh_instance_offsets(m, args[0].mesh, off, n);
+    arena_release(H->arena, mark);
+    return VMes(m);
+}
+
+static Value bi_scatter(Host *H, Value *args, int argc, char err[256]) {
+    bool points = argc == 2 && args[1].k == VAL_RING;
+    bool triples = argc >= 1 && (argc - 1) % 3 == 0 && all_num(args + 1, argc - 1);
+    if (argc < 1 || args[0].k != VAL_MESH || !(points || triples)) {
+        strcpy(err, "scatter(mesh, ring) or scatter(mesh, x0,y0,z0, x1,y1,z1, ...)");
+        return VVoid();
+    }
+    int n = points ? args[1].ring->count : (argc - 1) / 3;
+    if (n > REPLICATE_MAX) {
+        strcpy(err, "scatter: at most 1000000 copies");
+        return VVoid();
+    }
+    QMesh *m = new_mesh(H);
+    size_t mark = arena_mark(H->arena);
+    Vector3 *off = (Vector3 *) arena_alloc(H->arena, sizeof(Vector3) * (size_t) (n > 0 ? n : 1), alignof(Vector3));
+    if (points) {
+        QMesh *b = ensure_builder(H);
+        for (int i = 0; i < n; i++) off[i] = b->v[args[1].ring->idx[i]];
+    } else {
+        for (int i = 0; i < n; i++)
+            off[i] = (Vector3) {(float) ARGNUM(1 + i * 3), (float) ARGNUM(2 + i * 3), (float) ARGNUM(3 + i * 3)};
+    }
+    mesh_instance_offsets(m, args[0].mesh, off, n);
+    arena_release(H->arena, mark);
     return VMes(m);
 }
 
@@ -423,124 +780,135 @@ static Value bi_ringlist_push(Host *H, Value *args, int argc, char err[256]) {
     return VRingListPtrs(arr, n + 1);
 }
 
-static Value bi_bb_min_x(Host *H, Value *a, int n, char err[256]) {
+static Value bi_bbox(Host *H, Value *a, int n, char err[256]) {
     if (n != 1 || a[0].k != VAL_MESH) {
-        strcpy(err, "bb_min_x(mesh)");
+        strcpy(err, "bbox(mesh)");
+        return VVoid();
+    }
+    float *bb = (float *) arena_alloc(H->arena, sizeof(float) * 6, alignof(float));
+    mesh_bbox(a[0].mesh, bb, bb + 3);
+    return VBBox(bb);
+}
+
+// The bb_* accessors take a mesh (served from its cached bounds) or a bbox() value.
+static bool bb_arg(const Value *a, int n, float mn[3], float mx[3]) {
+    if (n != 1) return false;
+    if (a[0].k == VAL_BBOX) {
+        memcpy(mn, a[0].bbox, sizeof(float) * 3);
+        memcpy(mx, a[0].bbox + 3, sizeof(float) * 3);
+        return true;
+    }
+    if (a[0].k != VAL_MESH) return false;
+    mesh_bbox(a[0].mesh, mn, mx);
+    return true;
+}
+
+static Value bi_bb_min_x(Host *H, Value *a, int n, char err[256]) {
+    float mn[3], mx[3];
+    if (!bb_arg(a, n, mn, mx)) {
+        strcpy(err, "bb_min_x(mesh|bbox)");
         return VVoid();
     }
-    float mnx, mny, mnz, mxx, mxy, mxz;
-    mesh_bbox_minmax(a[0].mesh, &mnx, &mny, &mnz, &mxx, &mxy, &mxz);
-    return VNum(mnx);
+    return VNum(mn[0]);
 }
 
 static Value bi_bb_min_y(Host *H, Value *a, int n, char err[256]) {
-    if (n != 1 || a[0].k != VAL_MESH) {
-        strcpy(err, "bb_min_y(mesh)");
+    float mn[3], mx[3];
+    if (!bb_arg(a, n, mn, mx)) {
+        strcpy(err, "bb_min_y(mesh|bbox)");
         return VVoid();
     }
-    float mnx, mny, mnz, mxx, mxy, mxz;
-    mesh_bbox_minmax(a[0].mesh, &mnx, &mny, &mnz, &mxx, &mxy, &mxz);
-    return VNum(mny);
+    return VNum(mn[1]);
 }
 
 static Value bi_bb_min_z(Host *H, Value *a, int n, char err[256]) {
-    if (n != 1 || a[0].k != VAL_MESH) {
-        strcpy(err, "bb_min_z(mesh)");
+    float mn[3], mx[3];
+    if (!bb_arg(a, n, mn, mx)) {
+        strcpy(err, "bb_min_z(mesh|bbox)");
         return VVoid();
     }
-    float mnx, mny, mnz, mxx, mxy, mxz;
-    mesh_bbox_minmax(a[0].mesh, &mnx, &mny, &mnz, &mxx, &mxy, &mxz);
-    return VNum(mnz);
+    return VNum(mn[2]);
 }
 
 static Value bi_bb_max_x(Host *H, Value *a, int n, char err[256]) {
-    if (n != 1 || a[0].k != VAL_MESH) {
-        strcpy(err, "bb_max_x(mesh)");
+    float mn[3], mx[3];
+    if (!bb_arg(a, n, mn, mx)) {
+        strcpy(err, "bb_max_x(mesh|bbox)");
         return VVoid();
     }
-    float mnx, mny, mnz, mxx, mxy, mxz;
-    mesh_bbox_minmax(a[0].mesh, &mnx, &mny, &mnz, &mxx, &mxy, &mxz);
-    return VNum(mxx);
+    return VNum(mx[0]);
 }
 
 static Value bi_bb_max_y(Host *H, Value *a, int n, char err[256]) {
-    if (n != 1 || a[0].k != VAL_MESH) {
-        strcpy(err, "bb_max_y(mesh)");
+    float mn[3], mx[3];
+    if (!bb_arg(a, n, mn, mx)) {
+        strcpy(err, "bb_max_y(mesh|bbox)");
         return VVoid();
     }
-    float mnx, mny, mnz, mxx, mxy, mxz;
-    mesh_bbox_minmax(a[0].mesh, &mnx, &mny, &mnz, &mxx, &mxy, &mxz);
-    return VNum(mxy);
+    return VNum(mx[1]);
 }
 
 static Value bi_bb_max_z(Host *H, Value *a, int n, char err[256]) {
-    if (n != 1 || a[0].k != VAL_MESH) {
-        strcpy(err, "bb_max_z(mesh)");
+    float mn[3], mx[3];
+    if (!bb_arg(a, n, mn, mx)) {
+        strcpy(err, "bb_max_z(mesh|bbox)");
         return VVoid();
     }
-    float mnx, mny, mnz, mxx, mxy, mxz;
-    mesh_bbox_minmax(a[0].mesh, &mnx, &mny, &mnz, &mxx, &mxy, &mxz);
-    return VNum(mxz);
+    return VNum(mx[2]);
 }
 
 static Value bi_bb_size_x(Host *H, Value *a, int n, char err[256]) {
-    if (n != 1 || a[0].k != VAL_MESH) {
-        strcpy(err, "bb_size_x(mesh)");
+    float mn[3], mx[3];
+    if (!bb_arg(a, n, mn, mx)) {
+        strcpy(err, "bb_size_x(mesh|bbox)");
         return VVoid();
     }
-    float mnx, mny, mnz, mxx, mxy, mxz;
-    mesh_bbox_minmax(a[0].mesh, &mnx, &mny, &mnz, &mxx, &mxy, &mxz);
-    return VNum((double) (mxx - mnx));
+    return VNum((double) (mx[0] - mn[0]));
 }
 
 static Value bi_bb_size_y(Host *H, Value *a, int n, char err[256]) {
-    if (n != 1 || a[0].k != VAL_MESH) {
-        strcpy(err, "bb_size_y(mesh)");
+    float mn[3], mx[3];
+    if (!bb_arg(a, n, mn, mx)) {
+        strcpy(err, "bb_size_y(mesh|bbox)");
         return VVoid();
     }
-    float mnx, mny, mnz, mxx, mxy, mxz;
-    mesh_bbox_minmax(a[0].mesh, &mnx, &mny, &mnz, &mxx, &mxy, &mxz);
-    return VNum((double) (mxy - mny));
+    return VNum((double) (mx[1] - mn[1]));
 }
 
 static Value bi_bb_size_z(Host *H, Value *a, int n, char err[256]) {
-    if (n != 1 || a[0].k != VAL_MESH) {
-        strcpy(err, "bb_size_z(mesh)");
+    float mn[3], mx[3];
+    if (!bb_arg(a, n, mn, mx)) {
+        strcpy(err, "bb_size_z(mesh|bbox)");
         return VVoid();
     }
-    float mnx, mny, mnz, mxx, mxy, mxz;
-    mesh_bbox_minmax(a[0].mesh, &mnx, &mny, &mnz, &mxx, &mxy, &mxz);
-    return VNum((double) (mxz - mnz));
+    return VNum((double) (mx[2] - mn[2]));
 }
 
 static Value bi_bb_center_x(Host *H, Value *a, int n, char err[256]) {
-    if (n != 1 || a[0].k != VAL_MESH) {
-        strcpy(err, "bb_center_x(mesh)");
+    float mn[3], mx[3];
+    if (!bb_arg(a, n, mn, mx)) {
+        strcpy(err, "bb_center_x(mesh|bbox)");
         return VVoid();
     }
-    float mnx, mny, mnz, mxx, mxy, mxz;
-    mesh_bbox_minmax(a[0].mesh, &mnx, &mny, &mnz, &mxx, &mxy, &mxz);
-    return VNum(((double) mnx + (double) mxx) * 0.5);
+    return VNum(((double) mn[0] + (double) mx[0]) * 0.5);
 }
 
 static Value bi_bb_center_y(Host *H, Value *a, int n, char err[256]) {
-    if (n != 1 || a[0].k != VAL_MESH) {
-        strcpy(err, "bb_center_y(mesh)");
+    float mn[3], mx[3];
+    if (!bb_arg(a, n, mn, mx)) {
+        strcpy(err, "bb_center_y(mesh|bbox)");
         return VVoid();
     }
-    float mnx, mny, mnz, mxx, mxy, mxz;
-    mesh_bbox_minmax(a[0].mesh, &mnx, &mny, &mnz, &mxx, &mxy, &mxz);
-    return VNum(((double) mny + (double) mxy) * 0.5);
+    return VNum(((double) mn[1] + (double) mx[1]) * 0.5);
 }
 
 static Value bi_bb_center_z(Host *H, Value *a, int n, char err[256]) {
-    if (n != 1 || a[0].k != VAL_MESH) {
-        strcpy(err, "bb_center_z(mesh)");
+    float mn[3], mx[3];
+    if (!bb_arg(a, n, mn, mx)) {
+        strcpy(err, "bb_center_z(mesh|bbox)");
         return VVoid();
     }
-    float mnx, mny, mnz, mxx, mxy, mxz;
-    mesh_bbox_minmax(a[0].mesh, &mnx, &mny, &mnz, &mxx, &mxy, &mxz);
-    return VNum(((double) mnz + (double) mxz) * 0.5);
+    return VNum(((double) mn[2] + (double) mx[2]) * 0.5);
 }
 
 static Value bi_first(Host *H, Value *args, int argc, char err[256]) {
@@ -586,32 +954,17 @@ static Value bi_quad(Host *H, Value *args, int argc, char err[256]) {
     }
     QMesh *m = (QMesh *) arena_alloc(H->arena, sizeof(QMesh), 8);
     qm_init(m);
-    int a = qm_addv(m, b->v[ia]);
-    int b1 = qm_addv(m, b->v[ib]);
-    int c1 = qm_addv(m, b->v[ic]);
-    int d = qm_addv(m, b->v[id]);
+    qm_reserve(m, 4, 1);
+    int a = qm_addv_ref(m, b, ia);
+    int b1 = qm_addv_ref(m, b, ib);
+    int c1 = qm_addv_ref(m, b, ic);
+    int d = qm_addv_ref(m, b, id);
     qm_addq(m, a, b1, c1, d);
     return VMes(m);
 }
 
 static Value bi_mesh(Host *H, Value *args, int argc, char err[256]) {
-    if (argc > 0) {
-        int have = 0;
-        for (int i = 0; i < argc; i++)
-            if (args[i].k == VAL_MESH) {
-                have = 1;
-                break;
-            }
-        if (have) {
-            QMesh *out = (QMesh *) arena_alloc(H->arena, sizeof(QMesh), 8);
-            qm_init(out);
-            for (int i = 0; i < argc; i++) if (args[i].k == VAL_MESH) mesh_merge(out, args[i].mesh);
-            return VMes(out);
-        }
-    }
-    QMesh *empty = (QMesh *) arena_alloc(H->arena, sizeof(QMesh), 8);
-    qm_init(empty);
-    return VMes(empty);
+    return VMes(merge_args(H, args, argc));
 }
 
 static Value bi_error(Host *H, Value *args, int argc, char err[256]) {
@@ -644,11 +997,170 @@ static Value bi_print(Host *H, Value *args, int argc, char err[256]) {
     return VVoid();
 }
 
+static Value bi_raycast(Host *H, Value *args, int argc, char err[256]) {
+    if (argc != 7 || args[0].k != VAL_MESH || !all_num(args + 1, 6)) {
+        strcpy(err, "raycast(mesh, ox,oy,oz, dx,dy,dz)");
+        return VVoid();
+    }
+    Vector3 o = {(float) ARGNUM(1), (float) ARGNUM(2), (float) ARGNUM(3)};
+    Vector3 d = Vector3Normalize((Vector3) {(float) ARGNUM(4), (float) ARGNUM(5), (float) ARGNUM(6)});
+    if (d.x == 0.0f && d.y == 0.0f && d.z == 0.0f) {
+        strcpy(err, "raycast: zero direction");
+        return VVoid();
+    }
+    (void) H;
+    QMeshHit hit;
+    if (!mesh_raycast(args[0].mesh, o, d, INFINITY, &hit)) return VNum(-1.0);
+    return VNum(hit.t);
+}
+
+static Value bi_closest_point(Host *H, Value *args, int argc, char err[256]) {
+    if (argc != 4 || args[0].k != VAL_MESH || !all_num(args + 1, 3)) {
+        strcpy(err, "closest_point(mesh, x,y,z)");
+        return VVoid();
+    }
+    QMeshHit hit;
+    Vector3 p = {(float) ARGNUM(1), (float) ARGNUM(2), (float) ARGNUM(3)};
+    if (!mesh_closest_point(args[0].mesh, p, INFINITY, &hit)) {
+        strcpy(err, "closest_point: mesh has no quads");
+        return VVoid();
+    }
+    // a point is a zero-size bbox, so the bb_* accessors read it
+    float *bb = (float *) arena_alloc(H->arena, sizeof(float) * 6, alignof(float));
+    bb[0] = bb[3] = hit.p.x;
+    bb[1] = bb[4] = hit.p.y;
+    bb[2] = bb[5] = hit.p.z;
+    return VBBox(bb);
+}
+
+static Value bi_overlaps(Host *H, Value *args, int argc, char err[256]) {
+    if (argc != 2 || args[0].k != VAL_MESH || args[1].k != VAL_MESH) {
+        strcpy(err, "overlaps(mesh, mesh)");
+        return VVoid();
+    }
+    (void) H;
+    return boolv(mesh_overlaps(args[0].mesh, args[1].mesh));
+}
+
+static QSdf *new_sdf(Host *H, int op) {
+    QSdf *s = (QSdf *) arena_alloc(H->arena, sizeof(QSdf), alignof(QSdf));
+    memset(s, 0, sizeof(*s));
+    s->op = op;
+    return s;
+}
+
+static Value bi_sdf_sphere(Host *H, Value *args, int argc, char err[256]) {
+    if ((argc != 1 && argc != 4) || !all_num(args, argc)) {
+        strcpy(err, "sdf_sphere(r, cx=0,cy=0,cz=0)");
+        return VVoid();
+    }
+    QSdf *s = new_sdf(H, QSDF_SPHERE);
+    for (int k = 0; k < 3; k++) s->p[k] = argc == 4 ? (float) ARGNUM(1 + k) : 0.0f;
+    s->p[3] = (float) ARGNUM(0);
+    return VSdf(s);
+}
+
+static Value bi_sdf_box(Host *H, Value *args, int argc, char err[256]) {
+    if ((argc != 3 && argc != 4 && argc != 7) || !all_num(args, argc)) {
+        strcpy(err, "sdf_box(sx,sy,sz, round=0, cx=0,cy=0,cz=0)");
+        return VVoid();
+    }
+    QSdf *s = new_sdf(H, QSDF_BOX);
+    for (int k = 0; k < 3; k++) {
+        s->p[k] = argc == 7 ? (float) ARGNUM(4 + k) : 0.0f;
+        s->p[3 + k] = 0.5f * (float) ARGNUM(k);
+    }
+    s->p[6] = argc >= 4 ? (float) ARGNUM(3) : 0.0f;
+    return VSdf(s);
+}
+
+static Value bi_sdf_capsule(Host *H, Value *args, int argc, char err[256]) {
+    if (argc != 7 || !all_num(args, argc)) {
+        strcpy(err, "sdf_capsule(ax,ay,az, bx,by,bz, r)");
+        return VVoid();
+    }
+    QSdf *s = new_sdf(H, QSDF_CAPSULE);
+    for (int k = 0; k < 7; k++) s->p[k] = (float) ARGNUM(k);
+    return VSdf(s);
+}
+
+// Folds args[first..] left to right into a chain of op nodes.
+static Value sdf_fold(Host *H, Value *args, int argc, int first, int op, float k, const char *usage,
+                      char err[256]) {
+    bool ok = argc - first >= 2;
+    for (int i = first; ok && i < argc; i++) ok = args[i].k == VAL_SDF;
+    if (!ok) {
+        strcpy(err, usage);
+        return VVoid();
+    }
+    const QSdf *acc = args[first].sdf;
+    for (int i = first + 1; i < argc; i++) {
+        QSdf *s = new_sdf(H, op);
+        s->p[0] = k;
+        s->a = acc;
+        s->b = args[i].sdf;
+        acc = s;
+    }
+    return VSdf(acc);
+}
+
+static Value bi_sdf_union(Host *H, Value *args, int argc, char err[256]) {
+    return sdf_fold(H, args, argc, 0, QSDF_UNION, 0.0f, "sdf_union(sdf, sdf, ...)", err);
+}
+
+static Value bi_sdf_smooth_union(Host *H, Value *args, int argc, char err[256]) {
+    if (argc < 1 || args[0].k != VAL_NUMBER) {
+        strcpy(err, "sdf_smooth_union(k, sdf, sdf, ...)");
+        return VVoid();
+    }
+    return sdf_fold(H, args, argc, 1, QSDF_SMOOTH_UNION, (float) ARGNUM(0), "sdf_smooth_union(k, sdf, sdf, ...)",
+                    err);
+}
+
+static Value bi_sdf_subtract(Host *H, Value *args, int argc, char err[256]) {
+    return sdf_fold(H, args, argc, 0, QSDF_SUBTRACT, 0.0f, "sdf_subtract(sdf, cut, ...)", err);
+}
+
+static Value bi_sdf_intersect(Host *H, Value *args, int argc, char err[256]) {
+    return sdf_fold(H, args, argc, 0, QSDF_INTERSECT, 0.0f, "sdf_intersect(sdf, sdf, ...)", err);
+}
+
+static Value bi_sdf_round(Host *H, Value *args, int argc, char err[256]) {
+    if (argc != 2 || args[0].k != VAL_SDF || args[1].k != VAL_NUMBER) {
+        strcpy(err, "sdf_round(sdf, r)");
+        return VVoid();
+    }
+    QSdf *s = new_sdf(H, QSDF_ROUND);
+    s->p[0] = (float) ARGNUM(1);
+    s->a = args[0].sdf;
+    return VSdf(s);
+}
+
+static Value bi_polygonize(Host *H, Value *args, int argc, char err[256]) {
+    float mn[3], mx[3];
+    bool ok = (argc == 2 || argc == 3) && args[0].k == VAL_SDF && args[argc - 1].k == VAL_NUMBER;
+    if (ok && argc == 3) ok = bb_arg(args + 1, 1, mn, mx);
+    if (!ok) {
+        strcpy(err, "polygonize(sdf, bounds=auto, res)");
+        return VVoid();
+    }
+    int res = (int) ARGNUM(argc - 1);
+    if (res < 1 || res > 256) {
+        strcpy(err, "polygonize: res must be 1..256");
+        return VVoid();
+    }
+    if (argc == 2) sdf_bounds(args[0].sdf, mn, mx);
+    QMesh *m = new_mesh(H);
+    mesh_polygonize(m, args[0].sdf, mn, mx, res);
+    return VMes(m);
+}
+
 static const Builtin BI[] = {
         {"vertex",        bi_vertex},
         {"quad",          bi_quad},
         {"mesh",          bi_mesh},
         {"ring",          bi_ring},
+        {"polyline",      bi_polyline},
         {"ringlist_push", bi_ringlist_push},
         {"first",         bi_first},
         {"last",          bi_last},
@@ -661,16 +1173,43 @@ static const Builtin BI[] = {
         {"rotate_z",      bi_rotate_z},
         {"stitch",        bi_stitch},
         {"merge",         bi_merge},
+        {"merge_weld",    bi_merge_weld},
         {"mirror_x",      bi_mirror_x},
         {"mirror_y",      bi_mirror_y},
         {"mirror_z",      bi_mirror_z},
         {"move",          bi_move},
         {"scale",         bi_scale},
+        {"transform",     bi_transform},
+        {"array",         bi_array},
+        {"scatter",       bi_scatter},
         {"ringlist",      bi_ringlist},
         {"cap_plane",     bi_cap_plane},
         {"weld",          bi_weld},
+        {"compact",       bi_compact},
+        {"reorder_spatial", bi_reorder_spatial},
+        {"subdivide",     bi_subdivide},
+        {"simplify",      bi_simplify},
+        {"box",           bi_box},
+        {"cylinder",      bi_cylinder},
+        {"tube",          bi_tube},
+        {"sphere",        bi_sphere},
+        {"torus",         bi_torus},
+        {"sdf_sphere",    bi_sdf_sphere},
+        {"sdf_box",       bi_sdf_box},
+        {"sdf_capsule",   bi_sdf_capsule},
+        {"sdf_union",     bi_sdf_union},
+        {"sdf_smooth_union", bi_sdf_smooth_union},
+        {"sdf_subtract",  bi_sdf_subtract},
+        {"sdf_intersect", bi_sdf_intersect},
+        {"sdf_round",     bi_sdf_round},
+        {"polygonize",    bi_polygonize},
+        {"sweep",         bi_sweep},
         {"error",         bi_error},
         {"print",         bi_print},
+        {"bbox",          bi_bbox},
+        {"raycast",       bi_raycast},
+        {"closest_point", bi_closest_point},
+        {"overlaps",      bi_overlaps},
         {"bb_min_x",      bi_bb_min_x},
         {"bb_min_y",      bi_bb_min_y},
         {"bb_min_z",      bi_bb_min_z},
@@ -685,6 +1224,125 @@ static const Builtin BI[] = {
         {"bb_center_z",   bi_bb_center_z},
 };
 
+int host_builder_mark(const Host *H) {
+    return H->build ? H->build->vCount : 0;
+}
+
+// Rings are keyed by their index buffer, not the QRing: two rings may share one buffer, which
+// must be relocated once, over the longest count that uses it. Returns 0 when an earlier ring
+// already covered rings[i]'s buffer, else the count to relocate.
+static int ring_relocate_count(QRing **rings, int nr, int i) {
+    for (int j = 0; j < i; j++) if (rings[j] && rings[j]->idx == rings[i]->idx) return 0;
+    int count = rings[i]->count;
+    for (int j = i + 1; j < nr; j++)
+        if (rings[j] && rings[j]->idx == rings[i]->idx && rings[j]->count > count) count = rings[j]->count;
+    return count;
+}
+
+static void mesh_release_refs(Host *H, QMesh *m, int mark) {
+    if (!m->ref || m->refSrc != H->build) return;
+    size_t am = arena_mark(H->arena);
+    mesh_share_refs(m, host_alloc_trampoline, H);
+    arena_release(H->arena, am);
+    for (int i = 0; i < m->vCount; i++) if (m->ref[i] >= mark) m->ref[i] = -1;
+}
+
+typedef struct {
+    const QMesh *orig;
+    QMesh *copy;
+} BaseCopy;
+
+// Instance bases are shared values, so an instanced mesh gets its own copy of each base that
+// still points into the released part of the builder, and the copy is detached instead. A base
+// placed many times is copied once.
+static void inst_release_refs(Host *H, QMesh *m, int mark) {
+    unsigned cap = 64;
+    while (cap < (unsigned) m->instCount * 2u) cap <<= 1;
+    const unsigned mask = cap - 1;
+    BaseCopy *slots = (BaseCopy *) arena_alloc(H->arena, sizeof(BaseCopy) * cap, alignof(BaseCopy));
+    memset(slots, 0, sizeof(BaseCopy) * cap);
+    bool changed = false;
+    for (int j = 0; j < m->instCount; j++) {
+        const QMesh *b = m->inst[j].base;
+        if (!b->ref || b->refSrc != H->build) continue;
+        unsigned h = (unsigned) (((size_t) b >> 4) * 0x9e3779b1u) & mask;
+        while (slots[h].orig && slots[h].orig != b) h = (h + 1) & mask;
+        if (!slots[h].orig) {
+            bool released = false;
+            for (int i = 0; i < b->vCount && !released; i++) released = b->ref[i] >= mark;
+            slots[h].orig = b;
+            if (released) {
+                slots[h].copy = new_mesh(H);
+                mesh_merge(slots[h].copy, b);
+                mesh_release_refs(H, slots[h].copy, mark);
+            }
+        }
+        if (!slots[h].copy) continue;
+        m->inst[j].base = slots[h].copy;
+        changed = true;
+    }
+    if (changed) qm_touch(m);
+}
+
+void host_builder_release(Host *H, int mark, Value *keep) {
+    QMesh *b = H->build;
+    // the callee's Host copy, which ensure_builder left in the allocator, is gone; H is the caller's
+    if (b) qm_set_alloc(b, make_arena_alloc(H));
+    if (!b || b->vCount <= mark) return;
+    // a number may be a vertex() index; there is no way to tell, so keep everything
+    if (keep->k == VAL_NUMBER) return;
+
+    if (keep->k == VAL_MESH && keep->mesh) {
+        QMesh *m = keep->mesh;
+        // an instanced mesh reaches the builder through its bases
+        if (m->instCount) inst_release_refs(H, m, mark);
+        mesh_release_refs(H, m, mark);
+    }
+
+    QRing *single = NULL;
+    QRing **rings = NULL;
+    int nr = 0;
+    if (keep->k == VAL_RING && keep->ring) {
+        single = keep->ring;
+        rings = &single;
+        nr = 1;
+    } else if (keep->k == VAL_RINGLIST) {
+        rings = keep->ringlist.ptrs;
+        nr = keep->ringlist.count;
+    }
+
+    const int span = b->vCount - mark;
+    size_t am = arena_mark(H->arena);
+    int *remap = nr ? (int *) arena_alloc(H->arena, sizeof(int) * (size_t) span, 4) : NULL;
+    int live = 0;
+    if (remap) {
+        for (int i = 0; i < span; i++) remap[i] = -1;
+        for (int r = 0; r < nr; r++) {
+            if (!rings[r]) continue;
+            for (int k = 0; k < rings[r]->count; k++) {
+                int id = rings[r]->idx[k];
+                if (id >= mark) remap[id - mark] = 0;
+            }
+        }
+        // ascending order keeps every move in place: a survivor never lands above its source
+        for (int i = 0; i < span; i++) {
+            if (remap[i] < 0) continue;
+            remap[i] = mark + live++;
+            b->v[remap[i]] = b->v[mark + i];
+        }
+        for (int r = 0; r < nr; r++) {
+            const int count = rings[r] ? ring_relocate_count(rings, nr, r) : 0;
+            for (int k = 0; k < count; k++) {
+                int id = rings[r]->idx[k];
+                if (id >= mark) rings[r]->idx[k] = remap[id - mark];
+            }
+        }
+    }
+    b->vCount = mark + live;
+    qm_touch(b);
+    arena_release(H->arena, am);
+}
+
 const Builtin *intrinsics_table(int *outCount) {
     *outCount = (int) (sizeof(BI) / sizeof(BI[0]));
     return BI;
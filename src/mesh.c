@@ -1,8 +1,19 @@
 #include "mesh.h"
+#include "mesh_simd.h"
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
 #include <stdalign.h>
+#include <limits.h>
+
+// Element counts above which the bulk kernels split their loops across OpenMP threads.
+#define MESH_PAR_MIN 65536
+
+// First allocation size for meshes and rings grown one element at a time; a quad() result fits
+// without a second allocation. Bulk growth from empty allocates exactly what was asked for.
+#define QM_MIN_VCAP 4
+#define QM_MIN_QCAP 1
+#define QR_MIN_CAP 8
 
 static void *sys_realloc(void *ud, void *p, size_t sz, size_t align) {
     (void) ud;
@@ -28,6 +39,20 @@ static void qa_free(QAllocator *a, void *p) {
     else sys_free(NULL, p);
 }
 
+// Grows p from oldSz to sz bytes. A custom allocator only sees a fresh allocation (p == NULL):
+// it can't know the old block's size, so the old contents are copied here and the old block is
+// handed to free_fn. The system allocator keeps growing in place through realloc.
+static void *qa_grow(QAllocator *a, void *p, size_t oldSz, size_t sz, size_t align) {
+    if (!a->realloc_fn || a->realloc_fn == sys_realloc) return sys_realloc(NULL, p, sz, align);
+    void *np = a->realloc_fn(a->ud, NULL, sz, align);
+    if (!np) abort();
+    if (p) {
+        memcpy(np, p, oldSz < sz ? oldSz : sz);
+        qa_free(a, p);
+    }
+    return np;
+}
+
 void qm_init(QMesh *m) {
     memset(m, 0, sizeof(*m));
     m->alloc = QALLOC_SYS;
@@ -45,29 +70,155 @@ void qm_set_alloc(QMesh *m, QAllocator alloc) {
 void qm_free(QMesh *m) {
     qa_free(&m->alloc, m->v);
     qa_free(&m->alloc, m->q);
-    m->v = m->q = NULL;
+    qa_free(&m->alloc, m->inst);
+    qm_drop_refs(m);
+    qm_touch_quads(m);
+    m->v = NULL;
+    m->q = NULL;
+    m->inst = NULL;
+    m->instCount = m->instCap = 0;
     m->vCount = m->vCap = m->qCount = m->qCap = 0;
+    m->bbValid = false;
 }
 
-int qm_addv(QMesh *m, Vector3 p) {
-    if (m->vCount >= m->vCap) {
-        int newCap = m->vCap ? m->vCap * 2 : 256;
-        m->v = (Vector3 *) qa_realloc(&m->alloc, m->v, sizeof(Vector3) * (size_t) newCap, alignof(Vector3));
-        m->vCap = newCap;
+static void qm_drop_bvh(QMesh *m) {
+    mesh_bvh_free(m->bvh);
+    m->bvh = NULL;
+}
+
+void qm_touch(QMesh *m) {
+    m->bbValid = false;
+    qm_drop_bvh(m);
+}
+
+void qm_touch_quads(QMesh *m) {
+    free(m->adj);
+    m->adj = NULL;
+    qm_drop_bvh(m);
+}
+
+// Grows a valid cached bbox by [mn, mx]; an empty mesh adopts it.
+static void qm_bbox_extend(QMesh *m, const float mn[3], const float mx[3]) {
+    if (m->vCount == 0) {
+        memcpy(m->bbMin, mn, sizeof(m->bbMin));
+        memcpy(m->bbMax, mx, sizeof(m->bbMax));
+        m->bbValid = true;
+        return;
+    }
+    if (!m->bbValid) return;
+    for (int k = 0; k < 3; k++) {
+        if (mn[k] < m->bbMin[k]) m->bbMin[k] = mn[k];
+        if (mx[k] > m->bbMax[k]) m->bbMax[k] = mx[k];
     }
+}
+
+void qm_drop_refs(QMesh *m) {
+    if (m->ref) qa_free(&m->alloc, m->ref);
+    m->ref = NULL;
+    m->refSrc = NULL;
+}
+
+static int qm_next_cap(int cap, int need, int minCap) {
+    if (!cap) return need > minCap ? need : minCap;
+    int newCap = cap * 2;
+    while (newCap < need) newCap *= 2;
+    return newCap;
+}
+
+static void qm_grow_v(QMesh *m, int need) {
+    if (need <= m->vCap) return;
+    int newCap = qm_next_cap(m->vCap, need, QM_MIN_VCAP);
+    m->v = (Vector3 *) qa_grow(&m->alloc, m->v, sizeof(Vector3) * (size_t) m->vCap, sizeof(Vector3) * (size_t) newCap,
+                               alignof(Vector3));
+    if (m->ref)
+        m->ref = (int *) qa_grow(&m->alloc, m->ref, sizeof(int) * (size_t) m->vCap, sizeof(int) * (size_t) newCap,
+                                 alignof(int));
+    m->vCap = newCap;
+}
+
+// A mesh tracks refs against a single source, chosen while it is still empty.
+static bool qm_track_refs(QMesh *m, const QMesh *src) {
+    if (m->ref) return m->refSrc == src;
+    if (m->vCount > 0) return false;
+    m->refSrc = src;
+    return true;
+}
+
+// Carries src's refs into dst[off, off + src->vCount) after a copy, or marks the range unreferenced.
+static void qm_merge_refs(QMesh *dst, const QMesh *src, int off, bool sameVerts) {
+    bool carry = sameVerts && src->ref && (dst->ref ? dst->refSrc == src->refSrc : off == 0);
+    if (carry && !dst->ref) {
+        dst->ref = (int *) qa_realloc(&dst->alloc, NULL, sizeof(int) * (size_t) dst->vCap, alignof(int));
+        dst->refSrc = src->refSrc;
+    }
+    if (!dst->ref) return;
+    if (carry) memcpy(dst->ref + off, src->ref, sizeof(int) * (size_t) src->vCount);
+    else for (int i = 0; i < src->vCount; i++) dst->ref[off + i] = -1;
+}
+
+static void qm_grow_q(QMesh *m, int need) {
+    if (need <= m->qCap) return;
+    int newCap = qm_next_cap(m->qCap, need, QM_MIN_QCAP);
+    m->q = (Quad *) qa_grow(&m->alloc, m->q, sizeof(Quad) * (size_t) m->qCap, sizeof(Quad) * (size_t) newCap,
+                            alignof(Quad));
+    m->qCap = newCap;
+}
+
+void qm_reserve(QMesh *m, int vCap, int qCap) {
+    qm_grow_v(m, vCap);
+    qm_grow_q(m, qCap);
+}
+
+int qm_addv(QMesh *m, Vector3 p) {
+    if (m->vCount >= m->vCap) qm_grow_v(m, m->vCount + 1);
+    if (m->ref) m->ref[m->vCount] = -1;
+    const float f[3] = {p.x, p.y, p.z};
+    qm_bbox_extend(m, f, f);
     m->v[m->vCount] = p;
     return m->vCount++;
 }
 
+int qm_addv_ref(QMesh *m, const QMesh *src, int i) {
+    if (!qm_track_refs(m, src)) return qm_addv(m, src->v[i]);
+    if (m->vCount >= m->vCap) qm_grow_v(m, m->vCount + 1);
+    if (!m->ref) m->ref = (int *) qa_realloc(&m->alloc, NULL, sizeof(int) * (size_t) m->vCap, alignof(int));
+    m->ref[m->vCount] = i;
+    const float f[3] = {src->v[i].x, src->v[i].y, src->v[i].z};
+    qm_bbox_extend(m, f, f);
+    m->v[m->vCount] = src->v[i];
+    return m->vCount++;
+}
+
 void qm_addq(QMesh *m, int a, int b, int c, int d) {
-    if (m->qCount >= m->qCap) {
-        int newCap = m->qCap ? m->qCap * 2 : 256;
-        m->q = (Quad *) qa_realloc(&m->alloc, m->q, sizeof(Quad) * (size_t) newCap, alignof(Quad));
-        m->qCap = newCap;
-    }
+    if (m->qCount >= m->qCap) qm_grow_q(m, m->qCount + 1);
     m->q[m->qCount++] = (Quad) {a, b, c, d};
 }
 
+static int qm_append_v(QMesh *m, const Vector3 *p, int n) {
+    int first = m->vCount;
+    if (n <= 0) return first;
+    qm_grow_v(m, first + n);
+    memcpy(m->v + first, p, sizeof(Vector3) * (size_t) n);
+    if (m->ref) for (int i = 0; i < n; i++) m->ref[first + i] = -1;
+    m->vCount += n;
+    return first;
+}
+
+int qm_addv_n(QMesh *m, const Vector3 *p, int n) {
+    // scanning p here would double the cost of the copy; the next mesh_bbox rescans instead
+    if (n > 0) m->bbValid = false;
+    return qm_append_v(m, p, n);
+}
+
+int qm_addq_n(QMesh *m, const Quad *q, int n) {
+    int first = m->qCount;
+    if (n <= 0) return first;
+    qm_grow_q(m, first + n);
+    memcpy(m->q + first, q, sizeof(Quad) * (size_t) n);
+    m->qCount += n;
+    return first;
+}
+
 QRing qr_new(void) {
     QRing r;
     memset(&r, 0, sizeof(r));
@@ -88,26 +239,111 @@ void qr_free(QRing *r) {
     r->count = r->cap = 0;
 }
 
+void qr_reserve(QRing *r, int cap) {
+    if (cap <= r->cap) return;
+    int newCap = qm_next_cap(r->cap, cap, QR_MIN_CAP);
+    r->idx = (int *) qa_grow(&r->alloc, r->idx, sizeof(int) * (size_t) r->cap, sizeof(int) * (size_t) newCap,
+                             alignof(int));
+    r->cap = newCap;
+}
+
 void qr_push(QRing *r, int i) {
-    if (r->count >= r->cap) {
-        int newCap = r->cap ? r->cap * 2 : 64;
-        r->idx = (int *) qa_realloc(&r->alloc, r->idx, sizeof(int) * (size_t) newCap, alignof(
-        int));
-        r->cap = newCap;
-    }
+    if (r->count >= r->cap) qr_reserve(r, r->count + 1);
     r->idx[r->count++] = i;
 }
 
-QRing ring_ellipse(QMesh *m, float cx, float cy, float rx, float ry, int segs) {
-    QRing r = qr_new_with_alloc(m->alloc);
+// Template cache: unit circles and cap grid layouts depend only on the segment count, so one
+// context computes each once and every later ring or cap of that count replays it.
+typedef struct {
+    int segs;
+    float *cs;      // cos, sin per segment
+} CircleTpl;
+
+typedef struct {
+    int k;          // grid is (k + 1)^2 for a 4k ring
+    int *cell;      // ring slot for rim cells, -1 - interior ordinal otherwise
+    float *uw;      // u, w per interior point
+    int *side;      // ring slots of left, right, bottom and top per interior point
+} CapTpl;
+
+struct QTemplates {
+    CircleTpl *circ;
+    int nCirc, circCap;
+    CapTpl *cap;
+    int nCap, capCap;
+};
+
+QTemplates *qt_new(void) {
+    QTemplates *t = (QTemplates *) calloc(1, sizeof(QTemplates));
+    if (!t) abort();
+    return t;
+}
+
+static void circle_tpl_free(CircleTpl *c) {
+    free(c->cs);
+}
+
+static void cap_tpl_free(CapTpl *c) {
+    free(c->cell);
+    free(c->uw);
+    free(c->side);
+}
+
+void qt_free(QTemplates *t) {
+    if (!t) return;
+    for (int i = 0; i < t->nCirc; i++) circle_tpl_free(&t->circ[i]);
+    for (int i = 0; i < t->nCap; i++) cap_tpl_free(&t->cap[i]);
+    free(t->circ);
+    free(t->cap);
+    free(t);
+}
+
+static void circle_tpl_build(CircleTpl *c, int segs) {
+    c->segs = segs;
+    c->cs = (float *) malloc(sizeof(float) * 2 * (size_t) segs);
+    if (!c->cs) abort();
     for (int k = 0; k < segs; k++) {
         float t = (float) k / (float) segs * 2.0f * PI;
-        Vector3 p = (Vector3) {cx + rx * cosf(t), cy + ry * sinf(t), 0.0f};
+        c->cs[k * 2] = cosf(t);
+        c->cs[k * 2 + 1] = sinf(t);
+    }
+}
+
+static const CircleTpl *circle_tpl(QTemplates *t, int segs, CircleTpl *tmp) {
+    if (!t) {
+        circle_tpl_build(tmp, segs);
+        return tmp;
+    }
+    for (int i = 0; i < t->nCirc; i++) if (t->circ[i].segs == segs) return &t->circ[i];
+    if (t->nCirc == t->circCap) {
+        t->circCap = t->circCap ? t->circCap * 2 : 8;
+        t->circ = (CircleTpl *) realloc(t->circ, sizeof(CircleTpl) * (size_t) t->circCap);
+        if (!t->circ) abort();
+    }
+    circle_tpl_build(&t->circ[t->nCirc], segs);
+    return &t->circ[t->nCirc++];
+}
+
+QRing ring_ellipse_cached(QMesh *m, QTemplates *t, float cx, float cy, float rx, float ry, int segs) {
+    QRing r = qr_new_with_alloc(m->alloc);
+    if (segs <= 0) return r;
+    CircleTpl tmp;
+    const CircleTpl *c = circle_tpl(t, segs, &tmp);
+    qm_reserve(m, m->vCount + segs, 0);
+    qr_reserve(&r, segs);
+    const float *cs = c->cs;
+    for (int k = 0; k < segs; k++) {
+        Vector3 p = (Vector3) {cx + rx * cs[k * 2], cy + ry * cs[k * 2 + 1], 0.0f};
         qr_push(&r, qm_addv(m, p));
     }
+    if (!t) circle_tpl_free(&tmp);
     return r;
 }
 
+QRing ring_ellipse(QMesh *m, float cx, float cy, float rx, float ry, int segs) {
+    return ring_ellipse_cached(m, NULL, cx, cy, rx, ry, segs);
+}
+
 static Vector3 ring_centroid(const QMesh *m, const QRing *r) {
     Vector3 c = (Vector3) {0, 0, 0};
     for (int i = 0; i < r->count; i++) c = Vector3Add(c, m->v[r->idx[i]]);
@@ -117,6 +353,8 @@ static Vector3 ring_centroid(const QMesh *m, const QRing *r) {
 
 static QRing ring_inset_same_count(QMesh *m, const QRing *base, float dist) {
     QRing out = qr_new_with_alloc(m->alloc);
+    qm_reserve(m, m->vCount + base->count, 0);
+    qr_reserve(&out, base->count);
     Vector3 c = ring_centroid(m, base);
     for (int i = 0; i < base->count; i++) {
         Vector3 p = m->v[base->idx[i]];
@@ -127,7 +365,54 @@ static QRing ring_inset_same_count(QMesh *m, const QRing *base, float dist) {
     return out;
 }
 
-QMesh *cap_plane_build(QMesh *b, const QRing *outer, void *(*alloc)(void *, size_t, size_t), void *ud) {
+// Rim walk of a 4k ring: bottom runs slots 0..k, right k..2k, top 3k..2k and left 4k..3k, so
+// (i, j) = (0, 0) is slot 0 and the grid keeps the ring's winding.
+static void cap_tpl_build(CapTpl *c, int k) {
+    const int n = 4 * k, gw = k + 1, inner = (k - 1) * (k - 1);
+    c->k = k;
+    c->cell = (int *) malloc(sizeof(int) * (size_t) (gw * gw));
+    c->uw = (float *) malloc(sizeof(float) * 2 * (size_t) (inner > 0 ? inner : 1));
+    c->side = (int *) malloc(sizeof(int) * 4 * (size_t) (inner > 0 ? inner : 1));
+    if (!c->cell || !c->uw || !c->side) abort();
+    int next = 0;
+    for (int j = 0; j <= k; j++) {
+        for (int i = 0; i <= k; i++) {
+            int *cell = &c->cell[j * gw + i];
+            if (j == k) *cell = 2 * k + (k - i);
+            else if (j == 0) *cell = i;
+            else if (i == 0) *cell = (3 * k + (k - j)) % n;
+            else if (i == k) *cell = k + j;
+            else {
+                c->uw[next * 2] = (float) i / (float) k;
+                c->uw[next * 2 + 1] = (float) j / (float) k;
+                int *sd = &c->side[next * 4];
+                sd[0] = (3 * k + (k - j)) % n;  // left[j]
+                sd[1] = k + j;                  // right[j]
+                sd[2] = i;                      // bottom[i]
+                sd[3] = 2 * k + (k - i);        // top[i]
+                *cell = -1 - next++;
+            }
+        }
+    }
+}
+
+static const CapTpl *cap_tpl(QTemplates *t, int k, CapTpl *tmp) {
+    if (!t) {
+        cap_tpl_build(tmp, k);
+        return tmp;
+    }
+    for (int i = 0; i < t->nCap; i++) if (t->cap[i].k == k) return &t->cap[i];
+    if (t->nCap == t->capCap) {
+        t->capCap = t->capCap ? t->capCap * 2 : 8;
+        t->cap = (CapTpl *) realloc(t->cap, sizeof(CapTpl) * (size_t) t->capCap);
+        if (!t->cap) abort();
+    }
+    cap_tpl_build(&t->cap[t->nCap], k);
+    return &t->cap[t->nCap++];
+}
+
+QMesh *cap_plane_build_cached(QMesh *b, QTemplates *t, const QRing *outer,
+                              void *(*alloc)(void *, size_t, size_t), void *ud) {
 
     QMesh *cap = (QMesh *) alloc(ud, sizeof(QMesh), 8);
     qm_init_with_alloc(cap, b->alloc);
@@ -137,61 +422,32 @@ QMesh *cap_plane_build(QMesh *b, const QRing *outer, void *(*alloc)(void *, size
         return cap;
     }
 
-    QRing rim = *outer;
-
-    Vector3 *V = (Vector3 *) alloc(ud, sizeof(Vector3) * (size_t) n, alignof(Vector3));
-    for (int i = 0; i < n; i++) V[i] = b->v[rim.idx[i]];
-
-    const int k = n / 4;
+    const int k = n / 4, gw = k + 1;
+    CapTpl tmp;
+    const CapTpl *T = cap_tpl(t, k, &tmp);
+    const int *rim = outer->idx;
+    const Vector3 *V = b->v;
+    const Vector3 P00 = V[rim[0]];
+    const Vector3 P10 = V[rim[k]];
+    const Vector3 P01 = V[rim[3 * k]];
+    const Vector3 P11 = V[rim[2 * k]];
 
-    Vector3 *bottom = (Vector3 *) alloc(ud, sizeof(Vector3) * (size_t) (k + 1), alignof(Vector3));
-    Vector3 *right = (Vector3 *) alloc(ud, sizeof(Vector3) * (size_t) (k + 1), alignof(Vector3));
-    Vector3 *top = (Vector3 *) alloc(ud, sizeof(Vector3) * (size_t) (k + 1), alignof(Vector3));
-    Vector3 *left = (Vector3 *) alloc(ud, sizeof(Vector3) * (size_t) (k + 1), alignof(Vector3));
-
-    for (int i = 0; i <= k; i++) bottom[i] = V[0 + i];                 // 0..k
-    for (int i = 0; i <= k; i++) right[i] = V[k + i];                 // k..2k
-    for (int i = 0; i <= k; i++) top[i] = V[2 * k + (k - i)];         // 2k..3k
-    for (int i = 0; i <= k; i++) left[i] = V[(3 * k + (k - i)) % n];   // 3k..4k
-
-    const Vector3 P00 = bottom[0];
-    const Vector3 P10 = bottom[k];
-    const Vector3 P01 = top[0];
-    const Vector3 P11 = top[k];
-
-    const int gw = k + 1, gh = k + 1;
-    int *grid = (int *) alloc(ud, sizeof(int) * (size_t) (gw * gh), 4);
-
-    for (int j = 0; j <= k; j++) {
-        for (int i = 0; i <= k; i++) {
-            const int id = j * gw + i;
-            const int onTop = (j == k);
-            const int onBottom = (j == 0);
-            const int onLeft = (i == 0);
-            const int onRight = (i == k);
-
-            if (onTop) { grid[id] = qm_addv(cap, top[i]); }
-            else if (onBottom) { grid[id] = qm_addv(cap, bottom[i]); }
-            else if (onLeft) { grid[id] = qm_addv(cap, left[j]); }
-            else if (onRight) { grid[id] = qm_addv(cap, right[j]); }
-            else {
-                const float u = (float) i / (float) k;
-                const float v = (float) j / (float) k;
-
-                Vector3 C0 = left[j], C1 = right[j];
-                Vector3 D0 = bottom[i], D1 = top[i];
-
-                Vector3 term1 = Vector3Lerp(C0, C1, u);
-                Vector3 term2 = Vector3Lerp(D0, D1, v);
-
-                Vector3 BL0 = Vector3Lerp(P00, P10, u);
-                Vector3 BL1 = Vector3Lerp(P01, P11, u);
-                Vector3 BL = Vector3Lerp(BL0, BL1, v);
-
-                Vector3 P = Vector3Subtract(Vector3Add(term1, term2), BL);
-                grid[id] = qm_addv(cap, P);
-            }
+    qm_reserve(cap, gw * gw, k * k);
+    int *grid = (int *) alloc(ud, sizeof(int) * (size_t) (gw * gw), 4);
+    for (int id = 0; id < gw * gw; id++) {
+        const int c = T->cell[id];
+        // rim points are the ring's own vertices, so they keep a ref back to the builder
+        if (c >= 0) {
+            grid[id] = qm_addv_ref(cap, b, rim[c]);
+            continue;
         }
+        // Coons patch: blend of the two opposite side pairs minus the bilinear corner patch
+        const float u = T->uw[(-1 - c) * 2], v = T->uw[(-1 - c) * 2 + 1];
+        const int *sd = &T->side[(-1 - c) * 4];
+        Vector3 term1 = Vector3Lerp(V[rim[sd[0]]], V[rim[sd[1]]], u);
+        Vector3 term2 = Vector3Lerp(V[rim[sd[2]]], V[rim[sd[3]]], v);
+        Vector3 BL = Vector3Lerp(Vector3Lerp(P00, P10, u), Vector3Lerp(P01, P11, u), v);
+        grid[id] = qm_addv(cap, Vector3Subtract(Vector3Add(term1, term2), BL));
     }
 
     for (int j = 0; j < k; j++) {
@@ -204,87 +460,528 @@ QMesh *cap_plane_build(QMesh *b, const QRing *outer, void *(*alloc)(void *, size
             qm_addq(cap, A, B, C, D);
         }
     }
+    if (!t) cap_tpl_free(&tmp);
 
     return cap;
 }
 
+QMesh *cap_plane_build(QMesh *b, const QRing *outer, void *(*alloc)(void *, size_t, size_t), void *ud) {
+    return cap_plane_build_cached(b, NULL, outer, alloc, ud);
+}
+
+// Scratch for bulk passes: taken from the caller's allocator when given (and it has room),
+// otherwise malloc'd and flagged so the pass frees it on exit.
+static void *mesh_scratch(void *(*alloc)(void *, size_t, size_t), void *ud, size_t bytes, size_t align, int *owned) {
+    void *p = alloc ? alloc(ud, bytes, align) : NULL;
+    *owned = 0;
+    if (!p) {
+        p = malloc(bytes);
+        if (!p && bytes) abort();
+        *owned = 1;
+    }
+    return p;
+}
+
+typedef struct {
+    int gx, gy, gz;
+    int cell;
+} WeldSlot;
+
+static unsigned weld_hash(int gx, int gy, int gz) {
+    unsigned h = (unsigned) gx * 73856093u ^ (unsigned) gy * 19349663u ^ (unsigned) gz * 83492791u;
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    return h;
+}
+
+static int weld_find(const WeldSlot *tab, unsigned mask, int gx, int gy, int gz) {
+    unsigned h = weld_hash(gx, gy, gz) & mask;
+    while (tab[h].cell >= 0) {
+        if (tab[h].gx == gx && tab[h].gy == gy && tab[h].gz == gz) return tab[h].cell;
+        h = (h + 1) & mask;
+    }
+    return -1;
+}
+
 void mesh_weld_by_distance(QMesh *m, float eps) {
-    if (m->vCount == 0) return;
-
-    typedef struct {
-        int keyx, keyy, keyz;
-        int head;
-    } Cell;
-    // todo: use hash map
-    int cap = m->vCount * 2 + 64;
-    int *next = (int *) malloc(sizeof(int) * (size_t) m->vCount);
-    int *head = (int *) malloc(sizeof(int) * (size_t) cap);
-    for (int i = 0; i < cap; i++) head[i] = -1;
-
-    float inv = 1.0f / eps;
-    int *rep = (int *) malloc(sizeof(int) * (size_t) m->vCount);
-    for (int i = 0; i < m->vCount; i++) rep[i] = -1;
-
-    int h = 73856093; // pseudo hash
-    for (int i = 0; i < m->vCount; i++) {
+    mesh_weld_by_distance_ex(m, eps, NULL, NULL);
+}
+
+void mesh_weld_by_distance_ex(QMesh *m, float eps, void *(*alloc)(void *, size_t, size_t), void *ud) {
+    const int n = m->vCount;
+    if (n == 0 || !(eps > 0.0f)) return;
+
+    // cells are 2*eps wide: a partner within eps lies in the 2x2x2 block of cells on the
+    // near side of the vertex's own cell, so each query probes 8 cells instead of 27
+    unsigned cap = 64;
+    while (cap < (unsigned) n + (unsigned) n / 2u) cap <<= 1;
+    const unsigned mask = cap - 1;
+
+    size_t bytes = sizeof(WeldSlot) * cap + sizeof(int) * ((size_t) n * 4 + 1);
+    int owned = 0;
+    void *block = mesh_scratch(alloc, ud, bytes, alignof(WeldSlot), &owned);
+    WeldSlot *tab = (WeldSlot *) block;
+    int *cellOf = (int *) (tab + cap);
+    int *start = cellOf + n;
+    int *order = start + n + 1;
+    int *rep = order + n;
+
+    for (unsigned i = 0; i < cap; i++) tab[i].cell = -1;
+
+    const float inv = 0.5f / eps;
+    const float eps2 = eps * eps;
+
+    int cells = 0;
+    for (int i = 0; i < n; i++) {
         Vector3 p = m->v[i];
         int gx = (int) floorf(p.x * inv), gy = (int) floorf(p.y * inv), gz = (int) floorf(p.z * inv);
-        unsigned u = (unsigned) (gx * h ^ gy * 19349663 ^ gz * 83492791);
-        int bucket = (int) (u % (unsigned) cap);
-        int j = head[bucket];
-        int found = -1;
-        while (j != -1) {
-            Vector3 q = m->v[j];
-            float dx = p.x - q.x, dy = p.y - q.y, dz = p.z - q.z;
-            if (dx * dx + dy * dy + dz * dz <= eps * eps) {
-                found = j;
-                break;
+        unsigned h = weld_hash(gx, gy, gz) & mask;
+        while (tab[h].cell >= 0 && !(tab[h].gx == gx && tab[h].gy == gy && tab[h].gz == gz)) h = (h + 1) & mask;
+        if (tab[h].cell < 0) tab[h] = (WeldSlot) {gx, gy, gz, cells++};
+        cellOf[i] = tab[h].cell;
+    }
+
+    // bucket vertices by cell; inside a bucket indices stay ascending
+    memset(start, 0, sizeof(int) * (size_t) (cells + 1));
+    for (int i = 0; i < n; i++) start[cellOf[i] + 1]++;
+    for (int c = 0; c < cells; c++) start[c + 1] += start[c];
+    memcpy(rep, start, sizeof(int) * (size_t) cells);
+    for (int i = 0; i < n; i++) order[rep[cellOf[i]]++] = i;
+
+    // every vertex points at the lowest index within eps; independent per vertex,
+    // so the result does not depend on the thread count
+MESH_OMP(omp parallel for schedule(static) if (n >= MESH_PAR_MIN))
+    for (int i = 0; i < n; i++) {
+        Vector3 p = m->v[i];
+        float fx = floorf(p.x * inv), fy = floorf(p.y * inv), fz = floorf(p.z * inv);
+        int gx = (int) fx, gy = (int) fy, gz = (int) fz;
+        int sx = (p.x * inv - fx < 0.5f) ? -1 : 1;
+        int sy = (p.y * inv - fy < 0.5f) ? -1 : 1;
+        int sz = (p.z * inv - fz < 0.5f) ? -1 : 1;
+        int best = i;
+        for (int oz = 0; oz < 2; oz++) {
+            for (int oy = 0; oy < 2; oy++) {
+                for (int ox = 0; ox < 2; ox++) {
+                    int c = weld_find(tab, mask, gx + ox * sx, gy + oy * sy, gz + oz * sz);
+                    if (c < 0) continue;
+                    for (int s = start[c]; s < start[c + 1]; s++) {
+                        int j = order[s];
+                        if (j >= best) break;
+                        Vector3 q = m->v[j];
+                        float dx = p.x - q.x, dy = p.y - q.y, dz = p.z - q.z;
+                        if (dx * dx + dy * dy + dz * dz <= eps2) {
+                            best = j;
+                            break;
+                        }
+                    }
+                }
             }
-            j = next[j];
-        }
-        if (found == -1) {
-            next[i] = head[bucket];
-            head[bucket] = i;
-            rep[i] = i;
-        } else {
-            rep[i] = found;
         }
+        rep[i] = best;
+    }
+
+    // rep[i] <= i, so one forward pass collapses chains onto their root
+    int *newIndex = cellOf;
+    int newCount = 0;
+    for (int i = 0; i < n; i++) {
+        if (rep[i] == i) newIndex[i] = newCount++;
+        else rep[i] = rep[rep[i]];
     }
 
+    qm_touch_quads(m);
+MESH_OMP(omp parallel for schedule(static) if (m->qCount >= MESH_PAR_MIN))
     for (int qi = 0; qi < m->qCount; qi++) {
         Quad *q = &m->q[qi];
-        q->a = rep[q->a];
-        q->b = rep[q->b];
-        q->c = rep[q->c];
-        q->d = rep[q->d];
+        q->a = newIndex[rep[q->a]];
+        q->b = newIndex[rep[q->b]];
+        q->c = newIndex[rep[q->c]];
+        q->d = newIndex[rep[q->d]];
+    }
+
+    // survivors only move down, so compaction is done in place
+    for (int i = 0; i < n; i++) {
+        if (rep[i] != i) continue;
+        m->v[newIndex[i]] = m->v[i];
+        if (m->ref) m->ref[newIndex[i]] = m->ref[i];
+    }
+    m->vCount = newCount;
+    qm_touch(m);
+
+    if (owned) free(block);
+}
+
+// Vertex and quad counts of m once flattened.
+static void mesh_flat_counts(const QMesh *m, int *vc, int *qc) {
+    *vc = m->vCount;
+    *qc = m->qCount;
+    for (int i = 0; i < m->instCount; i++) {
+        *vc += m->inst[i].base->vCount;
+        *qc += m->inst[i].base->qCount;
+    }
+}
+
+typedef struct {
+    float lo;  // low x of the input's grown bounds
+    int k;
+} SweepKey;
+
+static int sweep_key_cmp(const void *a, const void *b) {
+    const SweepKey *x = (const SweepKey *) a, *y = (const SweepKey *) b;
+    return x->lo < y->lo ? -1 : x->lo > y->lo ? 1 : x->k - y->k;
+}
+
+// Pairs of inputs whose boxes (6 floats each, min then max) overlap, found by sorting on the low
+// x and sweeping, as a CSR list: the partners of k are part[start[k]] .. part[start[k + 1] - 1].
+// Inputs with no vertices take no part. Both arrays come from malloc; returns part.
+static int *box_overlaps(const float *box, const int *first, int n, int **startOut) {
+    SweepKey *key = (SweepKey *) malloc(sizeof(SweepKey) * (size_t) (n ? n : 1));
+    int *active = (int *) malloc(sizeof(int) * (size_t) (n ? n : 1));
+    int *start = (int *) calloc((size_t) n + 1, sizeof(int));
+    if (!key || !active || !start) abort();
+    int nk = 0;
+    for (int k = 0; k < n; k++)
+        if (first[k + 1] > first[k]) key[nk++] = (SweepKey) {box[k * 6], k};
+    qsort(key, (size_t) nk, sizeof(SweepKey), sweep_key_cmp);
+
+    // each overlap is found once, as (later, earlier) in sweep order
+    int *pair = NULL, pairCount = 0, pairCap = 0, na = 0;
+    for (int s = 0; s < nk; s++) {
+        const int k = key[s].k;
+        const float *a = box + k * 6;
+        int keep = 0;
+        for (int t = 0; t < na; t++) {
+            const int j = active[t];
+            const float *b = box + j * 6;
+            if (b[3] < a[0]) continue;  // ends before every later box starts
+            active[keep++] = j;
+            if (a[1] > b[4] || b[1] > a[4] || a[2] > b[5] || b[2] > a[5]) continue;
+            if (pairCount == pairCap) {
+                pairCap = pairCap ? pairCap * 2 : 64;
+                pair = (int *) realloc(pair, sizeof(int) * 2 * (size_t) pairCap);
+                if (!pair) abort();
+            }
+            pair[pairCount * 2] = k;
+            pair[pairCount * 2 + 1] = j;
+            pairCount++;
+            start[k + 1]++;
+            start[j + 1]++;
+        }
+        na = keep;
+        active[na++] = k;
+    }
+    for (int k = 0; k < n; k++) start[k + 1] += start[k];
+    int *part = (int *) malloc(sizeof(int) * (size_t) (start[n] ? start[n] : 1));
+    int *fill = active;  // no longer needed; reused as per-input write cursors
+    if (!part) abort();
+    for (int k = 0; k < n; k++) fill[k] = start[k];
+    for (int p = 0; p < pairCount; p++) {
+        const int k = pair[p * 2], j = pair[p * 2 + 1];
+        part[fill[k]++] = j;
+        part[fill[j]++] = k;
+    }
+    free(pair);
+    free(active);
+    free(key);
+    *startOut = start;
+    return part;
+}
+
+static bool box_inside(const float mn[3], const float mx[3], Vector3 p) {
+    return p.x >= mn[0] && p.x <= mx[0] && p.y >= mn[1] && p.y <= mx[1] && p.z >= mn[2] && p.z <= mx[2];
+}
+
+void mesh_merge_weld(QMesh *dst, const QMesh *const *src, int n, float eps,
+                     void *(*alloc)(void *, size_t, size_t), void *ud) {
+    int vTotal = dst->vCount, qTotal = dst->qCount;
+    for (int k = 0; k < n; k++) {
+        int vc, qc;
+        mesh_flat_counts(src[k], &vc, &qc);
+        vTotal += vc;
+        qTotal += qc;
     }
+    qm_reserve(dst, vTotal, qTotal);
+    const int v0 = dst->vCount;
+
+    // per input: its range in dst and its bounds grown by eps
+    int owned = 0;
+    size_t headBytes = sizeof(int) * ((size_t) n + 1) + sizeof(float) * 6 * (size_t) n;
+    void *head = mesh_scratch(alloc, ud, headBytes, alignof(float), &owned);
+    int *first = (int *) head;
+    float *box = (float *) (first + n + 1);
+    for (int k = 0; k < n; k++) {
+        first[k] = dst->vCount;
+        mesh_merge(dst, src[k]);
+        mesh_bbox(src[k], box + k * 6, box + k * 6 + 3);
+        for (int a = 0; a < 3; a++) {
+            box[k * 6 + a] -= eps;
+            box[k * 6 + 3 + a] += eps;
+        }
+    }
+    first[n] = dst->vCount;
+
+    // only vertices inside the overlap of two inputs' grown bounds can have a partner in
+    // another input; each input is checked against its overlapping partners only
+    int candCount = 0;
+    int *partStart;
+    int *part = box_overlaps(box, first, n, &partStart);
+    int *cand = NULL, *srcOf = NULL;
+    size_t candBytes = sizeof(int) * 2 * (size_t) (first[n] - v0);
+    int candOwned = 0;
+    void *candBlock = mesh_scratch(alloc, ud, candBytes ? candBytes : sizeof(int), alignof(int), &candOwned);
+    cand = (int *) candBlock;
+    srcOf = cand + (first[n] - v0);
+    for (int k = 0; k < n; k++) {
+        if (partStart[k + 1] == partStart[k]) continue;
+        for (int i = first[k]; i < first[k + 1]; i++) {
+            Vector3 p = dst->v[i];
+            for (int e = partStart[k]; e < partStart[k + 1]; e++) {
+                const int j = part[e];
+                float mn[3], mx[3];
+                for (int c = 0; c < 3; c++) {
+                    const float lo = box[k * 6 + c] > box[j * 6 + c] ? box[k * 6 + c] : box[j * 6 + c];
+                    const float hi = box[k * 6 + 3 + c] < box[j * 6 + 3 + c] ? box[k * 6 + 3 + c] : box[j * 6 + 3 + c];
+                    mn[c] = lo;
+                    mx[c] = hi;
+                }
+                if (box_inside(mn, mx, p)) {
+                    srcOf[candCount] = k;
+                    cand[candCount++] = i;
+                    break;
+                }
+            }
+        }
+    }
+
+    if (candCount > 0 && eps > 0.0f) {
+        // same 2*eps grid as mesh_weld_by_distance_ex, but filled input by input: each input's
+        // candidates look only at earlier inputs, then join the grid themselves
+        unsigned cap = 64;
+        while (cap < (unsigned) candCount + (unsigned) candCount / 2u) cap <<= 1;
+        const unsigned mask = cap - 1;
+        const int nv = dst->vCount - v0;
+        size_t bytes = sizeof(WeldSlot) * cap + sizeof(int) * ((size_t) candCount * 2 + (size_t) nv * 2);
+        int gOwned = 0;
+        void *block = mesh_scratch(alloc, ud, bytes, alignof(WeldSlot), &gOwned);
+        WeldSlot *tab = (WeldSlot *) block;
+        int *cellHead = (int *) (tab + cap);
+        int *next = cellHead + candCount;
+        int *rep = next + candCount;
+        int *newIndex = rep + nv;
+        for (unsigned i = 0; i < cap; i++) tab[i].cell = -1;
+        for (int i = 0; i < nv; i++) rep[i] = i;
+
+        const float inv = 0.5f / eps;
+        const float eps2 = eps * eps;
+        int cells = 0, merged = 0;
+        for (int c0 = 0; c0 < candCount;) {
+            int c1 = c0;
+            while (c1 < candCount && srcOf[c1] == srcOf[c0]) c1++;
+            for (int c = c0; c < c1; c++) {
+                Vector3 p = dst->v[cand[c]];
+                float fx = floorf(p.x * inv), fy = floorf(p.y * inv), fz = floorf(p.z * inv);
+                int gx = (int) fx, gy = (int) fy, gz = (int) fz;
+                int sx = (p.x * inv - fx < 0.5f) ? -1 : 1;
+                int sy = (p.y * inv - fy < 0.5f) ? -1 : 1;
+                int sz = (p.z * inv - fz < 0.5f) ? -1 : 1;
+                int best = cand[c];
+                for (int o = 0; o < 8; o++) {
+                    int cell = weld_find(tab, mask, gx + (o & 1) * sx, gy + ((o >> 1) & 1) * sy, gz + (o >> 2) * sz);
+                    for (int e = cell >= 0 ? cellHead[cell] : -1; e >= 0; e = next[e]) {
+                        int j = cand[e];
+                        if (j >= best) continue;
+                        Vector3 q = dst->v[j];
+                        float dx = p.x - q.x, dy = p.y - q.y, dz = p.z - q.z;
+                        if (dx * dx + dy * dy + dz * dz <= eps2) best = j;
+                    }
+                }
+                if (best != cand[c]) {
+                    rep[cand[c] - v0] = best - v0;
+                    merged++;
+                }
+            }
+            for (int c = c0; c < c1; c++) {
+                if (rep[cand[c] - v0] != cand[c] - v0) continue;
+                Vector3 p = dst->v[cand[c]];
+                int gx = (int) floorf(p.x * inv), gy = (int) floorf(p.y * inv), gz = (int) floorf(p.z * inv);
+                unsigned h = weld_hash(gx, gy, gz) & mask;
+                while (tab[h].cell >= 0 && !(tab[h].gx == gx && tab[h].gy == gy && tab[h].gz == gz))
+                    h = (h + 1) & mask;
+                if (tab[h].cell < 0) {
+                    tab[h] = (WeldSlot) {gx, gy, gz, cells};
+                    cellHead[cells++] = -1;
+                }
+                next[c] = cellHead[tab[h].cell];
+                cellHead[tab[h].cell] = c;
+            }
+            c0 = c1;
+        }
+
+        if (merged > 0) {
+            // representatives are never merged themselves, so there are no chains to collapse
+            int newCount = 0;
+            for (int i = 0; i < nv; i++) newIndex[i] = rep[i] == i ? v0 + newCount++ : -1;
+            qm_touch_quads(dst);
+            for (int qi = 0; qi < dst->qCount; qi++) {
+                Quad *q = &dst->q[qi];
+                if (q->a >= v0) q->a = newIndex[rep[q->a - v0]];
+                if (q->b >= v0) q->b = newIndex[rep[q->b - v0]];
+                if (q->c >= v0) q->c = newIndex[rep[q->c - v0]];
+                if (q->d >= v0) q->d = newIndex[rep[q->d - v0]];
+            }
+            for (int i = 0; i < nv; i++) {
+                if (rep[i] != i) continue;
+                dst->v[newIndex[i]] = dst->v[v0 + i];
+                if (dst->ref) dst->ref[newIndex[i]] = dst->ref[v0 + i];
+            }
+            dst->vCount = v0 + newCount;
+            qm_touch(dst);
+        }
+        if (gOwned) free(block);
+    }
+    if (candOwned) free(candBlock);
+    free(part);
+    free(partStart);
+    if (owned) free(head);
+}
+
+static unsigned quad_hash(Quad q) {
+    unsigned h = (unsigned) q.a * 0x9e3779b1u;
+    h = (h ^ (unsigned) q.b) * 0x85ebca6bu;
+    h = (h ^ (unsigned) q.c) * 0xc2b2ae35u;
+    h = (h ^ (unsigned) q.d) * 0x27d4eb2fu;
+    return h ^ (h >> 15);
+}
+
+// The face's cycle of distinct corners, rotated so the smallest index leads and padded with -1
+// for a triangle; winding is kept, so a flipped copy is not a duplicate. Returns the corner
+// count, or 0 when the quad has no area: fewer than 3 distinct corners, or folded (a == c or
+// b == d), which would triangulate to a degenerate pair or a back-to-back double face.
+static int quad_cycle(Quad q, Quad *key) {
+    const int v[4] = {q.a, q.b, q.c, q.d};
+    int c[4], n = 0;
+    for (int i = 0; i < 4; i++) if (v[i] != v[(i + 3) & 3]) c[n++] = v[i];
+    if (n < 3) return 0;
+    for (int i = 0; i < n; i++) for (int j = i + 1; j < n; j++) if (c[i] == c[j]) return 0;
+    int s = 0;
+    for (int i = 1; i < n; i++) if (c[i] < c[s]) s = i;
+    *key = (Quad) {c[s], c[(s + 1) % n], c[(s + 2) % n], n == 4 ? c[(s + 3) % n] : -1};
+    return n;
+}
+
+void mesh_share_refs(QMesh *m, void *(*alloc)(void *, size_t, size_t), void *ud) {
+    const int nv = m->vCount;
+    if (!m->ref || nv == 0) return;
+
+    unsigned cap = 64;
+    while (cap < (unsigned) nv * 2u) cap <<= 1;
+    const unsigned mask = cap - 1;
+
+    int owned = 0;
+    int *slots = (int *) mesh_scratch(alloc, ud, sizeof(int) * ((size_t) cap + (size_t) nv), alignof(int), &owned);
+    int *remap = slots + cap;
+    for (unsigned i = 0; i < cap; i++) slots[i] = -1;
 
-    int *newIndex = (int *) malloc(sizeof(int) * (size_t) m->vCount);
     int newCount = 0;
-    for (int i = 0; i < m->vCount; i++) {
-        if (rep[i] == i) newIndex[i] = newCount++;
+    for (int i = 0; i < nv; i++) {
+        int r = m->ref[i];
+        if (r >= 0) {
+            unsigned h = ((unsigned) r * 0x9e3779b1u) & mask;
+            while (slots[h] >= 0 && m->ref[slots[h]] != r) h = (h + 1) & mask;
+            if (slots[h] >= 0) {
+                remap[i] = slots[h];
+                continue;
+            }
+            slots[h] = newCount;
+        }
+        remap[i] = newCount;
+        m->ref[newCount] = r;
+        m->v[newCount++] = m->v[i];
     }
-    Vector3 *nv = (Vector3 *) malloc(sizeof(Vector3) * (size_t) newCount);
-    for (int i = 0; i < m->vCount; i++) if (rep[i] == i) nv[newIndex[i]] = m->v[i];
-    for (int qi = 0; qi < m->qCount; qi++) {
-        Quad *q = &m->q[qi];
-        q->a = newIndex[q->a];
-        q->b = newIndex[q->b];
-        q->c = newIndex[q->c];
-        q->d = newIndex[q->d];
+    if (newCount < nv) {
+        qm_touch_quads(m);
+        for (int qi = 0; qi < m->qCount; qi++) {
+            Quad *q = &m->q[qi];
+            q->a = remap[q->a];
+            q->b = remap[q->b];
+            q->c = remap[q->c];
+            q->d = remap[q->d];
+        }
     }
-    free(m->v);
-    m->v = nv;
     m->vCount = newCount;
 
-    free(next);
-    free(head);
-    free(rep);
-    free(newIndex);
+    if (owned) free(slots);
+}
+
+void mesh_compact(QMesh *m, void *(*alloc)(void *, size_t, size_t), void *ud) {
+    mesh_share_refs(m, alloc, ud);
+    const int nq = m->qCount, nv = m->vCount;
+    if (nq == 0) {
+        m->vCount = 0;
+        qm_touch(m);
+        qm_touch_quads(m);
+        return;
+    }
+
+    unsigned cap = 64;
+    while (cap < (unsigned) nq * 2u) cap <<= 1;
+    const unsigned mask = cap - 1;
+
+    int owned = 0;
+    int *slots = (int *) mesh_scratch(alloc, ud, sizeof(int) * ((size_t) cap + (size_t) nv), alignof(int), &owned);
+    int *remap = slots + cap;
+    for (unsigned i = 0; i < cap; i++) slots[i] = -1;
+    for (int i = 0; i < nv; i++) remap[i] = -1;
+
+    // quads without area go; one repeated adjacent corner is a triangle and stays, and
+    // triangles written with the repeat in different places dedupe against each other
+    int kept = 0;
+    for (int qi = 0; qi < nq; qi++) {
+        Quad q = m->q[qi], key, o;
+        if (!quad_cycle(q, &key)) continue;
+        unsigned h = quad_hash(key) & mask;
+        int dup = 0;
+        while (slots[h] >= 0) {
+            quad_cycle(m->q[slots[h]], &o);
+            if (o.a == key.a && o.b == key.b && o.c == key.c && o.d == key.d) {
+                dup = 1;
+                break;
+            }
+            h = (h + 1) & mask;
+        }
+        if (dup) continue;
+        slots[h] = kept;
+        m->q[kept++] = q;
+        remap[q.a] = remap[q.b] = remap[q.c] = remap[q.d] = 0;
+    }
+    m->qCount = kept;
+    qm_touch_quads(m);
+
+    int newCount = 0;
+    for (int i = 0; i < nv; i++) {
+        if (remap[i] < 0) continue;
+        remap[i] = newCount;
+        if (m->ref) m->ref[newCount] = m->ref[i];
+        m->v[newCount++] = m->v[i];
+    }
+    m->vCount = newCount;
+    qm_touch(m);
+
+    for (int qi = 0; qi < kept; qi++) {
+        Quad *q = &m->q[qi];
+        q->a = remap[q->a];
+        q->b = remap[q->b];
+        q->c = remap[q->c];
+        q->d = remap[q->d];
+    }
+
+    if (owned) free(slots);
 }
 
 QRing ring_grow_out(QMesh *m, const QRing *base, float step, float dz) {
     QRing out = qr_new_with_alloc(m->alloc);
+    qm_reserve(m, m->vCount + base->count, 0);
+    qr_reserve(&out, base->count);
     Vector3 c = ring_centroid(m, base);
     for (int i = 0; i < base->count; i++) {
         Vector3 p = m->v[base->idx[i]];
@@ -296,6 +993,7 @@ QRing ring_grow_out(QMesh *m, const QRing *base, float step, float dz) {
 }
 
 void ring_lift_x(QMesh *m, QRing *r, float dx) {
+    qm_touch(m);
     for (int i = 0; i < r->count; i++) {
         int id = r->idx[i];
         m->v[id].x += dx;
@@ -303,6 +1001,7 @@ void ring_lift_x(QMesh *m, QRing *r, float dx) {
 }
 
 void ring_lift_y(QMesh *m, QRing *r, float dy) {
+    qm_touch(m);
     for (int i = 0; i < r->count; i++) {
         int id = r->idx[i];
         m->v[id].y += dy;
@@ -310,6 +1009,7 @@ void ring_lift_y(QMesh *m, QRing *r, float dy) {
 }
 
 void ring_lift_z(QMesh *m, QRing *r, float dz) {
+    qm_touch(m);
     for (int i = 0; i < r->count; i++) {
         int id = r->idx[i];
         m->v[id].z += dz;
@@ -319,6 +1019,7 @@ void ring_lift_z(QMesh *m, QRing *r, float dz) {
 bool stitch(QMesh *m, const QRing *a, const QRing *b) {
     if (a->count != b->count) return false;
     int n = a->count;
+    qm_reserve(m, 0, m->qCount + n);
     for (int i = 0; i < n; i++) {
         int A = a->idx[i];
         int B = a->idx[(i + 1) % n];
@@ -330,129 +1031,1395 @@ bool stitch(QMesh *m, const QRing *a, const QRing *b) {
 }
 
 bool stitch_loop(QMesh *m, QRing *rings, int n) {
+    if (n > 1) qm_reserve(m, 0, m->qCount + rings[0].count * (n - 1));
     for (int i = 0; i < n - 1; i++) if (!stitch(m, &rings[i], &rings[i + 1])) return false;
     return true;
 }
 
+static void mesh_merge_insts(QMesh *dst, const QMeshInst *inst, int n);
+
 void mesh_merge(QMesh *dst, const QMesh *src) {
-    int off = dst->vCount;
-    for (int i = 0; i < src->vCount; i++) qm_addv(dst, src->v[i]);
-    for (int i = 0; i < src->qCount; i++) {
-        Quad q = src->q[i];
-        qm_addq(dst, q.a + off, q.b + off, q.c + off, q.d + off);
+    if (src->instCount) {
+        mesh_merge_insts(dst, src->inst, src->instCount);
+        return;
+    }
+    if (src->vCount == 0 && src->qCount == 0) return;
+    qm_reserve(dst, dst->vCount + src->vCount, dst->qCount + src->qCount);
+    if (src->vCount) {
+        if (src->bbValid) qm_bbox_extend(dst, src->bbMin, src->bbMax);
+        else dst->bbValid = false;
     }
+    int off = qm_append_v(dst, src->v, src->vCount);
+    qm_merge_refs(dst, src, off, true);
+    if (src->qCount)
+        mesh_kernels()->offset_idx((int *) (dst->q + dst->qCount), (const int *) src->q, src->qCount * 4, off);
+    dst->qCount += src->qCount;
 }
 
 void mesh_move(QMesh *m, float dx, float dy, float dz) {
-    for (int i = 0; i < m->vCount; i++) {
-        m->v[i].x += dx;
-        m->v[i].y += dy;
-        m->v[i].z += dz;
+    qm_drop_refs(m);
+    qm_drop_bvh(m);
+    // float addition is monotonic, so the shifted bounds are exactly the bounds of the shifted mesh
+    const float d[3] = {dx, dy, dz};
+    for (int k = 0; k < 3; k++) {
+        m->bbMin[k] += d[k];
+        m->bbMax[k] += d[k];
     }
+    mesh_kernels()->translate((float *) m->v, m->vCount, dx, dy, dz);
 }
 
 void mesh_scale(QMesh *m, float sx, float sy, float sz) {
-    for (int i = 0; i < m->vCount; i++) {
-        m->v[i].x *= sx;
-        m->v[i].y *= sy;
-        m->v[i].z *= sz;
+    qm_drop_refs(m);
+    qm_drop_bvh(m);
+    const float s[3] = {sx, sy, sz};
+    for (int k = 0; k < 3; k++) {
+        float a = m->bbMin[k] * s[k], b = m->bbMax[k] * s[k];
+        m->bbMin[k] = a < b ? a : b;
+        m->bbMax[k] = a < b ? b : a;
     }
+    mesh_kernels()->scale((float *) m->v, m->vCount, sx, sy, sz);
 }
 
 void mesh_rotate_x(QMesh *m, float rad) {
+    qm_drop_refs(m);
+    qm_touch(m);
     float c = cosf(rad), s = sinf(rad);
-    for (int i = 0; i < m->vCount; i++) {
-        float y = m->v[i].y, z = m->v[i].z;
-        m->v[i].y = y * c - z * s;
-        m->v[i].z = y * s + z * c;
-    }
+    const float M[12] = {1, 0, 0, 0,
+                         0, c, -s, 0,
+                         0, s, c, 0};
+    mesh_kernels()->affine((float *) m->v, (const float *) m->v, m->vCount, M);
 }
 
 void mesh_rotate_y(QMesh *m, float rad) {
+    qm_drop_refs(m);
+    qm_touch(m);
     float c = cosf(rad), s = sinf(rad);
-    for (int i = 0; i < m->vCount; i++) {
-        float x = m->v[i].x, z = m->v[i].z;
-        m->v[i].x = x * c + z * s;
-        m->v[i].z = -x * s + z * c;
-    }
+    const float M[12] = {c, 0, s, 0,
+                         0, 1, 0, 0,
+                         -s, 0, c, 0};
+    mesh_kernels()->affine((float *) m->v, (const float *) m->v, m->vCount, M);
 }
 
 void mesh_rotate_z(QMesh *m, float rad) {
+    qm_drop_refs(m);
+    qm_touch(m);
     float c = cosf(rad), s = sinf(rad);
-    for (int i = 0; i < m->vCount; i++) {
-        float x = m->v[i].x, y = m->v[i].y;
-        m->v[i].x = x * c - y * s;
-        m->v[i].y = x * s + y * c;
+    const float M[12] = {c, -s, 0, 0,
+                         s, c, 0, 0,
+                         0, 0, 1, 0};
+    mesh_kernels()->affine((float *) m->v, (const float *) m->v, m->vCount, M);
+}
+
+static void matrix_rows(const Matrix *M, float r[12]) {
+    r[0] = M->m0, r[1] = M->m4, r[2] = M->m8, r[3] = M->m12;
+    r[4] = M->m1, r[5] = M->m5, r[6] = M->m9, r[7] = M->m13;
+    r[8] = M->m2, r[9] = M->m6, r[10] = M->m10, r[11] = M->m14;
+}
+
+static bool matrix_flips(const float r[12]) {
+    float det = r[0] * (r[5] * r[10] - r[6] * r[9])
+                - r[1] * (r[4] * r[10] - r[6] * r[8])
+                + r[2] * (r[4] * r[9] - r[5] * r[8]);
+    return det < 0.0f;
+}
+
+// callers own the adjacency drop, since q may be a tail of the mesh's quads
+static void quads_flip(Quad *q, int n) {
+    for (int i = 0; i < n; i++) q[i] = (Quad) {q[i].d, q[i].c, q[i].b, q[i].a};
+}
+
+void mesh_transform(QMesh *m, const Matrix *M) {
+    qm_drop_refs(m);
+    qm_touch(m);
+    float r[12];
+    matrix_rows(M, r);
+    mesh_kernels()->affine((float *) m->v, (const float *) m->v, m->vCount, r);
+    if (matrix_flips(r)) {
+        quads_flip(m->q, m->qCount);
+        qm_touch_quads(m);
     }
 }
 
-void mesh_mirror_x(QMesh *m, float weldEps) {
-    int v0 = m->vCount;
-    for (int i = 0; i < v0; i++) {
-        Vector3 p = m->v[i];
-        p.x = -p.x;
-        qm_addv(m, p);
+static void mesh_merge_rows(QMesh *dst, const QMesh *src, const float r[12]) {
+    if (src->vCount == 0 && src->qCount == 0) return;
+    int off = dst->vCount, q0 = dst->qCount;
+    qm_reserve(dst, dst->vCount + src->vCount, dst->qCount + src->qCount);
+    if (src->vCount) qm_touch(dst);
+    mesh_kernels()->affine((float *) (dst->v + off), (const float *) src->v, src->vCount, r);
+    qm_merge_refs(dst, src, off, false);
+    if (src->qCount)
+        mesh_kernels()->offset_idx((int *) (dst->q + q0), (const int *) src->q, src->qCount * 4, off);
+    dst->vCount += src->vCount;
+    dst->qCount += src->qCount;
+    if (matrix_flips(r)) {
+        quads_flip(dst->q + q0, src->qCount);
+        qm_touch_quads(dst);
     }
-    int q0 = m->qCount;
-    for (int i = 0; i < q0; i++) {
-        Quad q = m->q[i];
-        qm_addq(m, q.d + v0, q.c + v0, q.b + v0, q.a + v0);
+}
+
+// out = a applied after b, both row-major 3x4
+static void xf_compose(const float a[12], const float b[12], float out[12]) {
+    for (int r = 0; r < 3; r++) {
+        const float *ar = a + r * 4;
+        for (int c = 0; c < 4; c++) out[r * 4 + c] = ar[0] * b[c] + ar[1] * b[4 + c] + ar[2] * b[8 + c];
+        out[r * 4 + 3] += ar[3];
     }
-    for (int i = 0; i < m->vCount; i++) if (fabsf(m->v[i].x) < weldEps) m->v[i].x = 0.f;
 }
 
-void mesh_mirror_y(QMesh *m, float weldEps) {
-    int v0 = m->vCount;
-    for (int i = 0; i < v0; i++) {
-        Vector3 p = m->v[i];
-        p.y = -p.y;
-        qm_addv(m, p);
+static bool xf_is_identity(const float r[12]) {
+    for (int i = 0; i < 12; i++) if (r[i] != ((i % 5) == 0 ? 1.0f : 0.0f)) return false;
+    return true;
+}
+
+void mesh_merge_transform(QMesh *dst, const QMesh *src, const Matrix *M) {
+    float r[12];
+    matrix_rows(M, r);
+    for (int i = 0; i < src->instCount; i++) {
+        float c[12];
+        xf_compose(r, src->inst[i].xf, c);
+        mesh_merge_rows(dst, src->inst[i].base, c);
+    }
+    mesh_merge_rows(dst, src, r);
+}
+
+// Identity placements go through mesh_merge so refs into the builder survive for
+// mesh_share_refs.
+static void mesh_merge_insts(QMesh *dst, const QMeshInst *inst, int n) {
+    int vTotal = dst->vCount, qTotal = dst->qCount;
+    for (int i = 0; i < n; i++) {
+        vTotal += inst[i].base->vCount;
+        qTotal += inst[i].base->qCount;
+    }
+    qm_reserve(dst, vTotal, qTotal);
+    for (int i = 0; i < n; i++) {
+        if (xf_is_identity(inst[i].xf)) mesh_merge(dst, inst[i].base);
+        else mesh_merge_rows(dst, inst[i].base, inst[i].xf);
+    }
+}
+
+static void qm_grow_inst(QMesh *m, int need) {
+    if (need <= m->instCap) return;
+    int newCap = qm_next_cap(m->instCap, need, 4);
+    m->inst = (QMeshInst *) qa_grow(&m->alloc, m->inst, sizeof(QMeshInst) * (size_t) m->instCap,
+                                    sizeof(QMeshInst) * (size_t) newCap, alignof(QMeshInst));
+    m->instCap = newCap;
+}
+
+static void qm_push_inst(QMesh *m, const QMesh *base, const float xf[12]) {
+    qm_touch(m);
+    qm_grow_inst(m, m->instCount + 1);
+    QMeshInst *in = &m->inst[m->instCount++];
+    in->base = base;
+    memcpy(in->xf, xf, sizeof(in->xf));
+}
+
+void mesh_instance(QMesh *dst, const QMesh *src, const Matrix *M) {
+    float r[12];
+    matrix_rows(M, r);
+    if (src->instCount == 0) {
+        if (src->vCount || src->qCount) qm_push_inst(dst, src, r);
+        return;
+    }
+    for (int i = 0; i < src->instCount; i++) {
+        float c[12];
+        xf_compose(r, src->inst[i].xf, c);
+        qm_push_inst(dst, src->inst[i].base, c);
+    }
+}
+
+// Writes base placed by xf (NULL = as is) into dst's storage at vertex vo and quad qo; no
+// bookkeeping, so calls on disjoint slots can run in parallel.
+static void mesh_place(QMesh *dst, int vo, int qo, const QMesh *base, const float *xf, const MeshKernels *K) {
+    if (xf) K->affine((float *) (dst->v + vo), (const float *) base->v, base->vCount, xf);
+    else if (base->vCount) memcpy(dst->v + vo, base->v, sizeof(Vector3) * (size_t) base->vCount);
+    if (base->qCount) K->offset_idx((int *) (dst->q + qo), (const int *) base->q, base->qCount * 4, vo);
+    if (xf && matrix_flips(xf)) quads_flip(dst->q + qo, base->qCount);
+}
+
+void mesh_merge_n(QMesh *dst, const QMesh *const *src, int n) {
+    static const float identity[12] = {1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0};
+    const int v0 = dst->vCount, q0 = dst->qCount;
+    int vTotal = v0, qTotal = q0, parts = 0;
+    for (int k = 0; k < n; k++) {
+        int vc, qc;
+        mesh_flat_counts(src[k], &vc, &qc);
+        vTotal += vc;
+        qTotal += qc;
+        parts += src[k]->instCount ? src[k]->instCount : 1;
+    }
+    if (vTotal == v0 && qTotal == q0) return;
+    qm_reserve(dst, vTotal, qTotal);
+
+    // one part per plain mesh or placement, with its slot from the prefix sums of the counts
+    QMeshInst *part = (QMeshInst *) malloc(sizeof(QMeshInst) * (size_t) parts + sizeof(int) * 2 * (size_t) parts);
+    if (!part) abort();
+    int *vOff = (int *) (part + parts), *qOff = vOff + parts;
+    int p = 0, vo = v0, qo = q0;
+    for (int k = 0; k < n; k++) {
+        const QMesh *m = src[k];
+        const int np = m->instCount ? m->instCount : 1;
+        for (int i = 0; i < np; i++, p++) {
+            if (m->instCount) part[p] = m->inst[i];
+            else {
+                part[p].base = m;
+                memcpy(part[p].xf, identity, sizeof(identity));
+            }
+            vOff[p] = vo;
+            qOff[p] = qo;
+            vo += part[p].base->vCount;
+            qo += part[p].base->qCount;
+        }
+    }
+
+    const MeshKernels *K = mesh_kernels();
+MESH_OMP(omp parallel for schedule(dynamic, 16) if (vTotal - v0 >= MESH_PAR_MIN))
+    for (int i = 0; i < parts; i++) {
+        const float *xf = xf_is_identity(part[i].xf) ? NULL : part[i].xf;
+        mesh_place(dst, vOff[i], qOff[i], part[i].base, xf, K);
+    }
+
+    // refs and bounds in input order, exactly as merging one at a time would leave them
+    bool bbValid = v0 == 0 || dst->bbValid, flipped = false;
+    float mn[3], mx[3];
+    for (int k = 0; k < 3; k++) {
+        mn[k] = v0 ? dst->bbMin[k] : INFINITY;
+        mx[k] = v0 ? dst->bbMax[k] : -INFINITY;
+    }
+    dst->vCount = vTotal;
+    dst->qCount = qTotal;
+    for (int i = 0; i < parts; i++) {
+        const QMesh *b = part[i].base;
+        const bool identity = xf_is_identity(part[i].xf);
+        qm_merge_refs(dst, b, vOff[i], identity);
+        flipped |= !identity && matrix_flips(part[i].xf);
+        if (!b->vCount) continue;
+        if (!identity || !b->bbValid) {
+            bbValid = false;
+            continue;
+        }
+        for (int k = 0; k < 3; k++) {
+            if (b->bbMin[k] < mn[k]) mn[k] = b->bbMin[k];
+            if (b->bbMax[k] > mx[k]) mx[k] = b->bbMax[k];
+        }
     }
-    int q0 = m->qCount;
+    free(part);
+    qm_touch(dst);
+    if (flipped) qm_touch_quads(dst);
+    if (bbValid) {
+        memcpy(dst->bbMin, mn, sizeof(mn));
+        memcpy(dst->bbMax, mx, sizeof(mx));
+        dst->bbValid = true;
+    }
+}
+
+void mesh_instance_offsets(QMesh *dst, const QMesh *src, const Vector3 *offsets, int n) {
+    const int per = src->instCount ? src->instCount : (src->vCount || src->qCount) ? 1 : 0;
+    qm_grow_inst(dst, dst->instCount + per * n);
+    for (int i = 0; i < n; i++) {
+        Matrix T = MatrixTranslate(offsets[i].x, offsets[i].y, offsets[i].z);
+        mesh_instance(dst, src, &T);
+    }
+}
+
+void mesh_flatten(QMesh *m) {
+    if (m->instCount == 0) return;
+    QMeshInst *inst = m->inst;
+    int n = m->instCount;
+    m->inst = NULL;
+    m->instCount = m->instCap = 0;
+    mesh_merge_insts(m, inst, n);
+    qa_free(&m->alloc, inst);
+}
+
+// Appends a copy reflected on `axis` with reversed winding, then snaps coordinates within
+// weldEps of the mirror plane onto it.
+static void mesh_mirror_axis(QMesh *m, int axis, float weldEps) {
+    qm_drop_refs(m);
+    qm_touch(m);
+    int v0 = m->vCount, q0 = m->qCount;
+    qm_reserve(m, v0 * 2, q0 * 2);
+    memcpy(m->v + v0, m->v, sizeof(Vector3) * (size_t) v0);
+    float s[3] = {1.0f, 1.0f, 1.0f};
+    s[axis] = -1.0f;
+    mesh_kernels()->scale((float *) (m->v + v0), v0, s[0], s[1], s[2]);
     for (int i = 0; i < q0; i++) {
         Quad q = m->q[i];
-        qm_addq(m, q.d + v0, q.c + v0, q.b + v0, q.a + v0);
+        m->q[q0 + i] = (Quad) {q.d + v0, q.c + v0, q.b + v0, q.a + v0};
     }
-    for (int i = 0; i < m->vCount; i++) if (fabsf(m->v[i].y) < weldEps) m->v[i].y = 0.f;
+    m->vCount = v0 * 2;
+    m->qCount = q0 * 2;
+    float *f = (float *) m->v + axis;
+    for (int i = 0; i < m->vCount; i++) if (fabsf(f[i * 3]) < weldEps) f[i * 3] = 0.f;
+}
+
+void mesh_mirror_x(QMesh *m, float weldEps) {
+    mesh_mirror_axis(m, 0, weldEps);
+}
+
+void mesh_mirror_y(QMesh *m, float weldEps) {
+    mesh_mirror_axis(m, 1, weldEps);
 }
 
 void mesh_mirror_z(QMesh *m, float weldEps) {
-    int v0 = m->vCount;
-    for (int i = 0; i < v0; i++) {
-        Vector3 p = m->v[i];
-        p.z = -p.z;
-        qm_addv(m, p);
+    mesh_mirror_axis(m, 2, weldEps);
+}
+
+const QMeshAdj *mesh_adjacency(const QMesh *m) {
+    if (m->adj && m->adj->vCount == m->vCount && m->adj->qCount == m->qCount) return m->adj;
+    // like the bbox, the cache is not observable state; building it through a const mesh is fine
+    QMesh *w = (QMesh *) m;
+    qm_touch_quads(w);
+
+    const int nv = m->vCount, nq = m->qCount, nc = nq * 4;
+    const int *corner = (const int *) m->q;
+
+    // half-edges bucketed by their lower vertex; a stamp per upper vertex dedupes each bucket
+    int *hStart = (int *) calloc((size_t) nv * 3 + 1 + (size_t) nc, sizeof(int));
+    if (!hStart) abort();
+    int *hList = hStart + nv + 1;
+    int *stamp = hList + nc;
+    int *edgeAt = stamp + nv;
+    for (int c = 0; c < nc; c++) {
+        int u = corner[c], x = corner[(c & ~3) | ((c + 1) & 3)];
+        if (u != x) hStart[(u < x ? u : x) + 1]++;
     }
-    int q0 = m->qCount;
-    for (int i = 0; i < q0; i++) {
-        Quad q = m->q[i];
-        qm_addq(m, q.d + v0, q.c + v0, q.b + v0, q.a + v0);
+    for (int i = 0; i < nv; i++) hStart[i + 1] += hStart[i];
+    const int nh = hStart[nv];
+    for (int i = 0; i < nv; i++) {
+        edgeAt[i] = hStart[i];
+        stamp[i] = -1;
+    }
+    for (int c = 0; c < nc; c++) {
+        int u = corner[c], x = corner[(c & ~3) | ((c + 1) & 3)];
+        if (u != x) hList[edgeAt[u < x ? u : x]++] = c;
+    }
+
+    // nh bounds the edge count, so the block is sized before edges are numbered
+    size_t bytes = sizeof(QMeshAdj) + sizeof(int) * ((size_t) nv + 1 + (size_t) nc * 2 + (size_t) nh * 3 + 1 + (size_t) nh);
+    // system heap, not w->alloc: an arena may be full, and the cache can outlive an arena
+    // mark/release window it was built in
+    QMeshAdj *A = (QMeshAdj *) malloc(bytes);
+    if (!A) abort();
+    A->vCount = nv;
+    A->qCount = nq;
+    A->vStart = (int *) (A + 1);
+    A->vCorner = A->vStart + nv + 1;
+    A->edgeOf = A->vCorner + nc;
+    A->eVert = A->edgeOf + nc;
+    A->eStart = A->eVert + (size_t) nh * 2;
+    A->eCorner = A->eStart + nh + 1;
+
+    for (int i = 0; i <= nv; i++) A->vStart[i] = 0;
+    for (int c = 0; c < nc; c++) A->vStart[corner[c] + 1]++;
+    for (int i = 0; i < nv; i++) A->vStart[i + 1] += A->vStart[i];
+    for (int i = 0; i < nv; i++) edgeAt[i] = A->vStart[i];
+    for (int c = 0; c < nc; c++) A->vCorner[edgeAt[corner[c]]++] = c;
+
+    int ne = 0;
+    for (int c = 0; c < nc; c++) A->edgeOf[c] = -1;
+    for (int lo = 0; lo < nv; lo++) {
+        for (int h = hStart[lo]; h < hStart[lo + 1]; h++) {
+            int c = hList[h];
+            int u = corner[c], x = corner[(c & ~3) | ((c + 1) & 3)];
+            int hi = u == lo ? x : u;
+            if (stamp[hi] != lo) {
+                stamp[hi] = lo;
+                edgeAt[hi] = ne;
+                A->eVert[ne * 2 + 0] = lo;
+                A->eVert[ne * 2 + 1] = hi;
+                ne++;
+            }
+            A->edgeOf[c] = edgeAt[hi];
+        }
     }
-    for (int i = 0; i < m->vCount; i++) if (fabsf(m->v[i].z) < weldEps) m->v[i].z = 0.f;
+    A->eCount = ne;
+
+    for (int e = 0; e <= ne; e++) A->eStart[e] = 0;
+    for (int c = 0; c < nc; c++) if (A->edgeOf[c] >= 0) A->eStart[A->edgeOf[c] + 1]++;
+    for (int e = 0; e < ne; e++) A->eStart[e + 1] += A->eStart[e];
+    free(hStart);
+
+    int *fill = (int *) malloc(sizeof(int) * ((size_t) ne + 1));
+    if (!fill) abort();
+    memcpy(fill, A->eStart, sizeof(int) * (size_t) ne);
+    for (int c = 0; c < nc; c++) if (A->edgeOf[c] >= 0) A->eCorner[fill[A->edgeOf[c]]++] = c;
+    free(fill);
+
+    w->adj = A;
+    return A;
 }
 
-void mesh_bbox_minmax(const QMesh *m, float *minx, float *miny, float *minz,
-                      float *maxx, float *maxy, float *maxz) {
-    if (!m || m->vCount <= 0) {
-        *minx = *miny = *minz = 0.0f;
-        *maxx = *maxy = *maxz = 0.0f;
+static Vector3 edge_mid(const Vector3 *v, const QMeshAdj *A, int e) {
+    return Vector3Scale(Vector3Add(v[A->eVert[e * 2]], v[A->eVert[e * 2 + 1]]), 0.5f);
+}
+
+// One Catmull-Clark level into exactly sized buffers: vertex points, then edge points, then face
+// points. Boundary and non-manifold edges stay creased at their midpoint.
+static void mesh_subdivide_once(QMesh *m) {
+    const QMeshAdj *A = mesh_adjacency(m);
+    const int nv = m->vCount, nq = m->qCount, ne = A->eCount;
+    const int *corner = (const int *) m->q;
+    const Vector3 *v = m->v;
+    const int eBase = nv, fBase = nv + ne;
+    Vector3 *nvtx = (Vector3 *) qa_realloc(&m->alloc, NULL, sizeof(Vector3) * (size_t) (nv + ne + nq), alignof(Vector3));
+    Quad *nquad = (Quad *) qa_realloc(&m->alloc, NULL, sizeof(Quad) * (size_t) nq * 4, alignof(Quad));
+
+MESH_OMP(omp parallel for schedule(static) if (nq >= MESH_PAR_MIN))
+    for (int qi = 0; qi < nq; qi++) {
+        const int *c = corner + qi * 4;
+        Vector3 sum = (Vector3) {0, 0, 0};
+        int n = 0;
+        for (int k = 0; k < 4; k++) {
+            if (k > 0 && c[k] == c[k - 1]) continue;
+            if (k == 3 && c[3] == c[0]) continue;
+            sum = Vector3Add(sum, v[c[k]]);
+            n++;
+        }
+        nvtx[fBase + qi] = Vector3Scale(sum, 1.0f / (float) n);
+    }
+
+MESH_OMP(omp parallel for schedule(static) if (ne >= MESH_PAR_MIN))
+    for (int e = 0; e < ne; e++) {
+        if (A->eStart[e + 1] - A->eStart[e] != 2) {
+            nvtx[eBase + e] = edge_mid(v, A, e);
+            continue;
+        }
+        Vector3 f0 = nvtx[fBase + (A->eCorner[A->eStart[e]] >> 2)];
+        Vector3 f1 = nvtx[fBase + (A->eCorner[A->eStart[e] + 1] >> 2)];
+        Vector3 sum = Vector3Add(Vector3Add(v[A->eVert[e * 2]], v[A->eVert[e * 2 + 1]]), Vector3Add(f0, f1));
+        nvtx[eBase + e] = Vector3Scale(sum, 0.25f);
+    }
+
+MESH_OMP(omp parallel for schedule(static) if (nv >= MESH_PAR_MIN))
+    for (int i = 0; i < nv; i++) {
+        const Vector3 P = v[i];
+        Vector3 fSum = (Vector3) {0, 0, 0}, rSum = (Vector3) {0, 0, 0};
+        Vector3 bSum = (Vector3) {0, 0, 0};
+        int faces = 0, bEdges = 0;
+        bool interior = true;
+        for (int s = A->vStart[i]; s < A->vStart[i + 1]; s++) {
+            int c = A->vCorner[s], q = c >> 2;
+            int prev = (c & ~3) | ((c + 3) & 3);
+            // a repeated corner belongs to the face already counted for its first occurrence
+            if (corner[prev] != i) {
+                fSum = Vector3Add(fSum, nvtx[fBase + q]);
+                faces++;
+            }
+            // each manifold edge shows up twice here: leaving one face and entering the next
+            int touching[2] = {A->edgeOf[c], A->edgeOf[prev]};
+            for (int t = 0; t < 2; t++) {
+                int e = touching[t];
+                if (e < 0) continue;
+                int uses = A->eStart[e + 1] - A->eStart[e];
+                rSum = Vector3Add(rSum, edge_mid(v, A, e));
+                if (uses != 2) interior = false;
+                if (uses == 1) {
+                    bSum = Vector3Add(bSum, edge_mid(v, A, e));
+                    bEdges++;
+                }
+            }
+        }
+        Vector3 out = P;
+        if (faces > 0 && interior) {
+            float n = (float) faces;
+            Vector3 F = Vector3Scale(fSum, 1.0f / n);
+            Vector3 R = Vector3Scale(rSum, 0.5f / n);
+            out = Vector3Scale(Vector3Add(Vector3Add(F, Vector3Scale(R, 2.0f)), Vector3Scale(P, n - 3.0f)), 1.0f / n);
+        } else if (bEdges == 2) {
+            out = Vector3Add(Vector3Scale(P, 0.5f), Vector3Scale(bSum, 0.25f));
+        }
+        nvtx[i] = out;
+    }
+
+MESH_OMP(omp parallel for schedule(static) if (nq >= MESH_PAR_MIN))
+    for (int qi = 0; qi < nq; qi++) {
+        const int *c = corner + qi * 4;
+        for (int k = 0; k < 4; k++) {
+            int eOut = A->edgeOf[qi * 4 + k], eIn = A->edgeOf[qi * 4 + ((k + 3) & 3)];
+            int vp = c[k];
+            nquad[qi * 4 + k] = (Quad) {vp, eOut >= 0 ? eBase + eOut : vp, fBase + qi, eIn >= 0 ? eBase + eIn : vp};
+        }
+    }
+
+    qm_drop_refs(m);
+    qm_touch_quads(m);
+    qm_touch(m);
+    qa_free(&m->alloc, m->v);
+    qa_free(&m->alloc, m->q);
+    m->v = nvtx;
+    m->q = nquad;
+    m->vCount = m->vCap = nv + ne + nq;
+    m->qCount = m->qCap = nq * 4;
+}
+
+void mesh_subdivide(QMesh *m, int levels) {
+    for (int l = 0; l < levels && m->qCount > 0; l++) mesh_subdivide_once(m);
+}
+
+// Quadric error metric simplification (Garland-Heckbert) over quads. A collapse merges edge a-b
+// into one vertex; faces holding the edge lose a corner, so quads turn into triangles (a repeated
+// corner) and triangles disappear. Sizes are counted in triangles, as the exporters emit them.
+
+#define SIMP_BOUNDARY_WEIGHT 10.0
+
+enum { SIMP_FREE = 0, SIMP_BOUNDARY = 1, SIMP_LOCKED = 2 };
+
+// Symmetric 4x4 plane quadric (xx, xy, xz, xw, yy, yz, yw, zz, zw, ww) plus the face area it sums.
+typedef struct {
+    double q[10];
+    double area;
+} SimpQuadric;
+
+typedef struct {
+    float cost;
+    int a, b;
+    unsigned sa, sb;
+} SimpEdge;
+
+typedef struct {
+    QMesh *m;
+    int *corner;            // m->q viewed as corners, rewritten in place as vertices merge
+    int *head, *next;       // vertex -> its corners, as linked lists
+    unsigned *stamp;        // bumped whenever a vertex moves or absorbs another
+    int *mark;              // scratch marks for neighbour sets
+    int markId;
+    unsigned char *flags, *faceDead;
+    SimpQuadric *Q;
+    SimpEdge *heap;
+    int heapCount, heapCap;
+} Simp;
+
+static void simp_add_plane(SimpQuadric *Q, double a, double b, double c, double d, double w) {
+    double p[4] = {a, b, c, d};
+    int k = 0;
+    for (int i = 0; i < 4; i++)
+        for (int j = i; j < 4; j++) Q->q[k++] += w * p[i] * p[j];
+}
+
+static double simp_eval(const SimpQuadric *Q, Vector3 p) {
+    const double *q = Q->q;
+    double x = p.x, y = p.y, z = p.z;
+    double e = q[0] * x * x + 2 * q[1] * x * y + 2 * q[2] * x * z + 2 * q[3] * x
+               + q[4] * y * y + 2 * q[5] * y * z + 2 * q[6] * y
+               + q[7] * z * z + 2 * q[8] * z + q[9];
+    return e > 0 ? e : 0;
+}
+
+static void simp_heap_push(Simp *S, SimpEdge e) {
+    if (S->heapCount == S->heapCap) {
+        S->heapCap = S->heapCap ? S->heapCap * 2 : 256;
+        S->heap = (SimpEdge *) realloc(S->heap, sizeof(SimpEdge) * (size_t) S->heapCap);
+        if (!S->heap) abort();
+    }
+    int i = S->heapCount++;
+    while (i > 0) {
+        int p = (i - 1) / 2;
+        if (S->heap[p].cost <= e.cost) break;
+        S->heap[i] = S->heap[p];
+        i = p;
+    }
+    S->heap[i] = e;
+}
+
+static SimpEdge simp_heap_pop(Simp *S) {
+    SimpEdge top = S->heap[0], last = S->heap[--S->heapCount];
+    int i = 0, n = S->heapCount;
+    for (;;) {
+        int c = i * 2 + 1;
+        if (c >= n) break;
+        if (c + 1 < n && S->heap[c + 1].cost < S->heap[c].cost) c++;
+        if (S->heap[c].cost >= last.cost) break;
+        S->heap[i] = S->heap[c];
+        i = c;
+    }
+    if (n > 0) S->heap[i] = last;
+    return top;
+}
+
+// Distinct corners of a face in winding order; returns how many.
+static int simp_face_ring(const int *c, int ring[4]) {
+    int n = 0;
+    for (int k = 0; k < 4; k++) {
+        if (n > 0 && ring[n - 1] == c[k]) continue;
+        ring[n++] = c[k];
+    }
+    if (n > 1 && ring[n - 1] == ring[0]) n--;
+    return n;
+}
+
+static Vector3 simp_face_normal(const Vector3 *v, const int *ring, int n, int from, Vector3 to) {
+    // Newell's method, with vertex `from` read at `to`
+    Vector3 s = (Vector3) {0, 0, 0};
+    for (int k = 0; k < n; k++) {
+        Vector3 p = ring[k] == from ? to : v[ring[k]];
+        Vector3 q = ring[(k + 1) % n] == from ? to : v[ring[(k + 1) % n]];
+        s.x += (p.y - q.y) * (p.z + q.z);
+        s.y += (p.z - q.z) * (p.x + q.x);
+        s.z += (p.x - q.x) * (p.y + q.y);
+    }
+    return s;
+}
+
+// True when the Newell normal n (twice the area) is negligible against the face's squared size.
+static bool simp_face_flat(const Vector3 *v, const int *ring, int n, Vector3 nrm) {
+    float size2 = 0.0f;
+    for (int k = 0; k < n; k++) size2 += Vector3DistanceSqr(v[ring[k]], v[ring[(k + 1) % n]]);
+    return Vector3Length(nrm) <= 1e-6f * size2;
+}
+
+// A face lists each of its corners on that vertex; only the first one speaks for the face.
+static bool simp_first_corner(const Simp *S, int c) {
+    for (int k = c & ~3; k < c; k++) if (S->corner[k] == S->corner[c]) return false;
+    return true;
+}
+
+// Live faces using both a and b as neighbouring corners.
+static int simp_edge_faces(const Simp *S, int a, int b) {
+    int n = 0;
+    for (int c = S->head[a]; c >= 0; c = S->next[c]) {
+        int f = c >> 2;
+        if (S->faceDead[f] || !simp_first_corner(S, c)) continue;
+        int ring[4], rn = simp_face_ring(S->corner + f * 4, ring);
+        for (int k = 0; k < rn; k++)
+            if (ring[k] == a && (ring[(k + 1) % rn] == b || ring[(k + rn - 1) % rn] == b)) n++;
+    }
+    return n;
+}
+
+// Where a-b would collapse to and what it costs; *keep is the vertex that survives. Returns
+// false when the collapse would move a locked or boundary vertex off its place.
+static bool simp_edge_target(const Simp *S, int a, int b, Vector3 *to, int *keep, float *cost) {
+    const Vector3 *v = S->m->v;
+    int fa = S->flags[a], fb = S->flags[b];
+    if (fa == SIMP_LOCKED && fb == SIMP_LOCKED) return false;
+    if (fa != SIMP_FREE && fb != SIMP_FREE && (fa == SIMP_LOCKED || fb == SIMP_LOCKED || simp_edge_faces(S, a, b) != 1))
+        return false;
+
+    SimpQuadric Q = S->Q[a];
+    for (int i = 0; i < 10; i++) Q.q[i] += S->Q[b].q[i];
+    Q.area += S->Q[b].area;
+
+    *keep = a;
+    if (fa > fb) {
+        *to = v[a];
+    } else if (fb > fa) {
+        *keep = b;
+        *to = v[b];
+    } else {
+        const double *q = Q.q;
+        double A00 = q[0], A01 = q[1], A02 = q[2], A11 = q[4], A12 = q[5], A22 = q[7];
+        double b0 = -q[3], b1 = -q[6], b2 = -q[8];
+        double c00 = A11 * A22 - A12 * A12, c01 = A02 * A12 - A01 * A22, c02 = A01 * A12 - A02 * A11;
+        double det = A00 * c00 + A01 * c01 + A02 * c02;
+        double tr = A00 + A11 + A22;
+        bool solved = false;
+        if (fabs(det) > 1e-9 * tr * tr * tr) {
+            double c11 = A00 * A22 - A02 * A02, c12 = A01 * A02 - A00 * A12, c22 = A00 * A11 - A01 * A01;
+            Vector3 p = (Vector3) {(float) ((c00 * b0 + c01 * b1 + c02 * b2) / det),
+                                   (float) ((c01 * b0 + c11 * b1 + c12 * b2) / det),
+                                   (float) ((c02 * b0 + c12 * b1 + c22 * b2) / det)};
+            // an ill-conditioned optimum far away from the edge is worse than an endpoint
+            Vector3 mid = Vector3Scale(Vector3Add(v[a], v[b]), 0.5f);
+            float len = Vector3Distance(v[a], v[b]);
+            if (Vector3Distance(p, mid) <= len * 2.0f) {
+                *to = p;
+                solved = true;
+            }
+        }
+        if (!solved) {
+            Vector3 cand[3] = {v[a], v[b], Vector3Scale(Vector3Add(v[a], v[b]), 0.5f)};
+            double best = -1;
+            for (int i = 0; i < 3; i++) {
+                double e = simp_eval(&Q, cand[i]);
+                if (best < 0 || e < best) {
+                    best = e;
+                    *to = cand[i];
+                }
+            }
+        }
+    }
+    // reported as an RMS distance so it can be compared against a length
+    double e = simp_eval(&Q, *to);
+    *cost = (float) sqrt(Q.area > 0 ? e / Q.area : e);
+    return true;
+}
+
+static void simp_push_edge(Simp *S, int a, int b) {
+    Vector3 to;
+    int keep;
+    float cost;
+    if (!simp_edge_target(S, a, b, &to, &keep, &cost)) return;
+    simp_heap_push(S, (SimpEdge) {cost, a, b, S->stamp[a], S->stamp[b]});
+}
+
+// Marks the neighbours of x with a fresh id and returns it.
+static int simp_mark_neighbours(Simp *S, int x) {
+    int id = ++S->markId;
+    for (int c = S->head[x]; c >= 0; c = S->next[c]) {
+        int f = c >> 2;
+        if (S->faceDead[f]) continue;
+        int ring[4], rn = simp_face_ring(S->corner + f * 4, ring);
+        for (int k = 0; k < rn; k++)
+            if (ring[k] == x) {
+                S->mark[ring[(k + 1) % rn]] = id;
+                S->mark[ring[(k + rn - 1) % rn]] = id;
+            }
+    }
+    S->mark[x] = 0;
+    return id;
+}
+
+// Rejects collapses that would fold a face over, pinch the surface (a shared neighbour that is
+// not the tip of a triangle on the edge) or join two opposite corners of a quad.
+static bool simp_collapse_ok(Simp *S, int keep, int gone, Vector3 to) {
+    const Vector3 *v = S->m->v;
+    int id = simp_mark_neighbours(S, keep);
+    for (int pass = 0; pass < 2; pass++) {
+        int x = pass ? keep : gone;
+        for (int c = S->head[x]; c >= 0; c = S->next[c]) {
+            int f = c >> 2;
+            if (S->faceDead[f]) continue;
+            int ring[4], rn = simp_face_ring(S->corner + f * 4, ring);
+            int ik = -1, ig = -1;
+            for (int k = 0; k < rn; k++) {
+                if (ring[k] == keep) ik = k;
+                if (ring[k] == gone) ig = k;
+            }
+            if (ik >= 0 && ig >= 0) {
+                int d = (ik - ig + rn) % rn;
+                if (d != 1 && d != rn - 1) return false;
+                if (rn == 3) {
+                    int tip = ring[3 - ik - ig];
+                    S->mark[tip] = -id;  // a legitimate shared neighbour
+                }
+                continue;
+            }
+            Vector3 n0 = simp_face_normal(v, ring, rn, -1, to);
+            // a face with no area has no orientation to flip; testing it would block every
+            // collapse around it
+            if (simp_face_flat(v, ring, rn, n0)) continue;
+            Vector3 n1 = simp_face_normal(v, ring, rn, x, to);
+            if (Vector3DotProduct(n0, n1) <= 0.0f) return false;
+        }
+    }
+    for (int c = S->head[gone]; c >= 0; c = S->next[c]) {
+        int f = c >> 2;
+        if (S->faceDead[f]) continue;
+        int ring[4], rn = simp_face_ring(S->corner + f * 4, ring);
+        for (int k = 0; k < rn; k++)
+            if (ring[k] == gone) {
+                int w0 = ring[(k + 1) % rn], w1 = ring[(k + rn - 1) % rn];
+                if ((w0 != keep && S->mark[w0] == id) || (w1 != keep && S->mark[w1] == id)) return false;
+            }
+    }
+    return true;
+}
+
+// Moves every corner of gone onto keep; returns how many triangles disappeared.
+static int simp_collapse(Simp *S, int keep, int gone, Vector3 to) {
+    int lost = 0, last = -1;
+    for (int c = S->head[gone]; c >= 0; c = S->next[c]) {
+        last = c;
+        if (S->corner[c] != gone) continue;  // rewritten together with an earlier corner of its face
+        int f = c >> 2, ring[4];
+        int before = S->faceDead[f] ? 0 : simp_face_ring(S->corner + f * 4, ring);
+        for (int k = f * 4; k < f * 4 + 4; k++) if (S->corner[k] == gone) S->corner[k] = keep;
+        if (S->faceDead[f]) continue;
+        int after = simp_face_ring(S->corner + f * 4, ring);
+        if (after < 3) {
+            S->faceDead[f] = 1;
+            after = 2;
+        }
+        lost += before - after;
+    }
+    if (last >= 0) {
+        S->next[last] = S->head[keep];
+        S->head[keep] = S->head[gone];
+        S->head[gone] = -1;
+    }
+    for (int i = 0; i < 10; i++) S->Q[keep].q[i] += S->Q[gone].q[i];
+    S->Q[keep].area += S->Q[gone].area;
+    if (S->flags[gone] > S->flags[keep]) S->flags[keep] = S->flags[gone];
+    S->m->v[keep] = to;
+    S->stamp[keep]++;
+    S->stamp[gone]++;
+    return lost;
+}
+
+int mesh_simplify(QMesh *m, float ratio, float maxError, void *(*alloc)(void *, size_t, size_t), void *ud) {
+    const int nv = m->vCount, nq = m->qCount, nc = nq * 4;
+    if (nq == 0) return 0;
+    const QMeshAdj *A = mesh_adjacency(m);
+    const Vector3 *v = m->v;
+
+    size_t bytes = sizeof(SimpQuadric) * (size_t) nv + sizeof(int) * ((size_t) nv * 3 + (size_t) nc) + (size_t) nv + (size_t) nq;
+    int owned = 0;
+    char *block = (char *) mesh_scratch(alloc, ud, bytes, alignof(SimpQuadric), &owned);
+    Simp S;
+    memset(&S, 0, sizeof(S));
+    S.m = m;
+    S.corner = (int *) m->q;
+    S.Q = (SimpQuadric *) block;
+    S.head = (int *) (S.Q + nv);
+    S.stamp = (unsigned *) (S.head + nv);
+    S.mark = (int *) (S.stamp + nv);
+    S.next = S.mark + nv;
+    S.flags = (unsigned char *) (S.next + nc);
+    S.faceDead = S.flags + nv;
+    memset(S.Q, 0, sizeof(SimpQuadric) * (size_t) nv);
+    memset(S.flags, SIMP_FREE, (size_t) nv);
+    for (int i = 0; i < nv; i++) {
+        S.head[i] = -1;
+        S.stamp[i] = 0;
+        S.mark[i] = 0;
+    }
+    for (int c = nc - 1; c >= 0; c--) {
+        S.next[c] = S.head[S.corner[c]];
+        S.head[S.corner[c]] = c;
+    }
+
+    // each face adds the planes of its two triangles, weighted by their area
+    int tris = 0;
+    for (int f = 0; f < nq; f++) {
+        int ring[4], rn = simp_face_ring(S.corner + f * 4, ring);
+        S.faceDead[f] = rn < 3;
+        if (rn < 3) continue;
+        tris += rn - 2;
+        for (int t = 0; t + 2 < rn; t++) {
+            int i0 = ring[0], i1 = ring[t + 1], i2 = ring[t + 2];
+            Vector3 n = Vector3CrossProduct(Vector3Subtract(v[i1], v[i0]), Vector3Subtract(v[i2], v[i0]));
+            float len = Vector3Length(n);
+            if (len <= 0.0f) continue;
+            double area = len * 0.5, nx = n.x / len, ny = n.y / len, nz = n.z / len;
+            double d = -(nx * v[i0].x + ny * v[i0].y + nz * v[i0].z);
+            for (int k = 0; k < 3; k++) {
+                SimpQuadric *Q = &S.Q[k == 0 ? i0 : k == 1 ? i1 : i2];
+                simp_add_plane(Q, nx, ny, nz, d, area);
+                Q->area += area;
+            }
+        }
+    }
+    // open edges get a steep plane through them, perpendicular to their face; vertices on
+    // non-manifold edges never move
+    for (int e = 0; e < A->eCount; e++) {
+        int uses = A->eStart[e + 1] - A->eStart[e];
+        int a = A->eVert[e * 2], b = A->eVert[e * 2 + 1];
+        if (uses > 2) {
+            S.flags[a] = S.flags[b] = SIMP_LOCKED;
+            continue;
+        }
+        if (uses != 1) continue;
+        if (S.flags[a] == SIMP_FREE) S.flags[a] = SIMP_BOUNDARY;
+        if (S.flags[b] == SIMP_FREE) S.flags[b] = SIMP_BOUNDARY;
+        int f = A->eCorner[A->eStart[e]] >> 2;
+        int ring[4], rn = simp_face_ring(S.corner + f * 4, ring);
+        if (rn < 3) continue;
+        Vector3 fn = Vector3Normalize(simp_face_normal(v, ring, rn, -1, v[a]));
+        Vector3 ed = Vector3Subtract(v[b], v[a]);
+        Vector3 pn = Vector3CrossProduct(ed, fn);
+        float len = Vector3Length(pn);
+        if (len <= 0.0f) continue;
+        double w = (double) Vector3LengthSqr(ed) * SIMP_BOUNDARY_WEIGHT;
+        double nx = pn.x / len, ny = pn.y / len, nz = pn.z / len;
+        double d = -(nx * v[a].x + ny * v[a].y + nz * v[a].z);
+        simp_add_plane(&S.Q[a], nx, ny, nz, d, w);
+        simp_add_plane(&S.Q[b], nx, ny, nz, d, w);
+    }
+
+    for (int e = 0; e < A->eCount; e++) simp_push_edge(&S, A->eVert[e * 2], A->eVert[e * 2 + 1]);
+
+    int target = (int) ((double) tris * (ratio < 0 ? 0 : ratio));
+    while (tris > target && S.heapCount > 0) {
+        SimpEdge e = simp_heap_pop(&S);
+        if (e.sa != S.stamp[e.a] || e.sb != S.stamp[e.b]) continue;
+        if (e.cost > maxError) break;
+        Vector3 to;
+        int keep;
+        float cost;
+        if (!simp_edge_target(&S, e.a, e.b, &to, &keep, &cost)) continue;
+        int gone = keep == e.a ? e.b : e.a;
+        if (!simp_collapse_ok(&S, keep, gone, to)) continue;
+        tris -= simp_collapse(&S, keep, gone, to);
+        // every edge around the merged vertex now has a different cost
+        int id = simp_mark_neighbours(&S, keep);
+        for (int c = S.head[keep]; c >= 0; c = S.next[c]) {
+            int f = c >> 2;
+            if (S.faceDead[f]) continue;
+            for (int k = f * 4; k < f * 4 + 4; k++) {
+                int w = S.corner[k];
+                if (S.mark[w] != id) continue;
+                S.mark[w] = 0;
+                simp_push_edge(&S, keep, w);
+            }
+        }
+    }
+
+    // dead faces are left with fewer than 3 distinct corners; compaction drops them together
+    // with the vertices nothing uses any more
+    free(S.heap);
+    if (owned) free(block);
+    qm_drop_refs(m);
+    qm_touch(m);
+    qm_touch_quads(m);
+    mesh_compact(m, alloc, ud);
+    return tris;
+}
+
+// Quads per short_diag call; the flags for one block live on the stack.
+#define TRI_BLOCK 1024
+
+static void tri_emit_block(const Vector3 *v, const Quad *q, int n, unsigned base, int shortest, int flip,
+                           unsigned *out) {
+    unsigned char bd[TRI_BLOCK];
+    if (shortest) mesh_kernels()->short_diag((const float *) v, (const int *) q, n, bd);
+    else memset(bd, 0, (size_t) n);
+    for (int i = 0; i < n; i++) {
+        unsigned a = (unsigned) q[i].a + base, b = (unsigned) q[i].b + base;
+        unsigned c = (unsigned) q[i].c + base, d = (unsigned) q[i].d + base;
+        unsigned t[6] = {a, b, c, a, c, d};
+        if (bd[i]) {
+            t[2] = d;
+            t[3] = b;
+        }
+        if (flip) {
+            unsigned s = t[1];
+            t[1] = t[2], t[2] = s;
+            s = t[4];
+            t[4] = t[5], t[5] = s;
+        }
+        memcpy(out + (size_t) i * 6, t, sizeof(t));
+    }
+}
+
+void mesh_triangulate_indices(const Vector3 *v, const Quad *q, int qCount, unsigned base,
+                              int choose_shortest_diag, int flip_winding, unsigned *out) {
+    const int blocks = (qCount + TRI_BLOCK - 1) / TRI_BLOCK;
+MESH_OMP(omp parallel for schedule(static) if (qCount >= MESH_PAR_MIN))
+    for (int bi = 0; bi < blocks; bi++) {
+        int first = bi * TRI_BLOCK;
+        int n = qCount - first < TRI_BLOCK ? qCount - first : TRI_BLOCK;
+        tri_emit_block(v, q + first, n, base, choose_shortest_diag, flip_winding, out + (size_t) first * 6);
+    }
+}
+
+void mesh_triangulate_quads(const QMesh *src, TMesh *out, int choose_shortest_diag, int flip_winding,
+                            void *(*alloc)(void *, size_t, size_t), void *ud) {
+    // positions are shared with src rather than copied
+    out->v = src->v;
+    out->vCount = src->vCount;
+    out->iCount = src->qCount * 6;
+    size_t bytes = sizeof(unsigned) * (size_t) out->iCount;
+    out->indices = (unsigned *) (alloc ? alloc(ud, bytes, alignof(unsigned)) : malloc(bytes));
+    if (!out->indices) {
+        out->iCount = 0;
         return;
     }
-    Vector3 v0 = m->v[0];
-    float mnx = v0.x, mny = v0.y, mnz = v0.z, mxx = v0.x, mxy = v0.y, mxz = v0.z;
-    for (int i = 1; i < m->vCount; i++) {
-        Vector3 v = m->v[i];
-        if (v.x < mnx) mnx = v.x;
-        if (v.y < mny) mny = v.y;
-        if (v.z < mnz) mnz = v.z;
-        if (v.x > mxx) mxx = v.x;
-        if (v.y > mxy) mxy = v.y;
-        if (v.z > mxz) mxz = v.z;
-    }
-    *minx = mnx;
-    *miny = mny;
-    *minz = mnz;
-    *maxx = mxx;
-    *maxy = mxy;
-    *maxz = mxz;
-}
\ No newline at end of file
+    mesh_triangulate_indices(src->v, src->q, src->qCount, 0, choose_shortest_diag, flip_winding, out->indices);
+}
+
+float mesh_acmr(const unsigned *indices, int iCount, int vCount, int cacheSize) {
+    if (iCount < 3 || cacheSize <= 0) return 0.0f;
+    // FIFO cache: a vertex is resident while fewer than cacheSize misses have happened since its own
+    int *missAt = (int *) malloc(sizeof(int) * (size_t) (vCount > 0 ? vCount : 1));
+    if (!missAt) abort();
+    for (int i = 0; i < vCount; i++) missAt[i] = INT_MIN / 2;
+    int misses = 0;
+    for (int i = 0; i < iCount; i++) {
+        unsigned v = indices[i];
+        if (misses - missAt[v] >= cacheSize) missAt[v] = misses++;
+    }
+    free(missAt);
+    return (float) misses / (float) (iCount / 3);
+}
+
+// Tipsify: fan out from one vertex at a time, emitting all its remaining triangles, and pick the
+// next fan vertex among those just touched that will still be in cache.
+void mesh_optimize_vertex_cache(unsigned *indices, int iCount, int vCount, int cacheSize) {
+    const int nt = iCount / 3;
+    if (nt < 2 || vCount <= 0) return;
+    size_t words = (size_t) vCount * 3 + 1 + (size_t) nt * 3 + (size_t) nt * 3 + (size_t) iCount;
+    int *block = (int *) malloc(sizeof(int) * words);
+    unsigned char *emitted = (unsigned char *) calloc((size_t) nt, 1);
+    if (!block || !emitted) abort();
+    int *start = block;                 // vertex -> triangles, CSR
+    int *live = start + vCount + 1;     // triangles not yet emitted per vertex
+    int *stamp = live + vCount;         // cache timestamp per vertex
+    int *tris = stamp + vCount;
+    int *deadEnd = tris + nt * 3;       // recently touched vertices, most recent on top
+    unsigned *out = (unsigned *) (deadEnd + nt * 3);
+
+    for (int i = 0; i <= vCount; i++) start[i] = 0;
+    for (int i = 0; i < nt * 3; i++) start[indices[i] + 1]++;
+    for (int i = 0; i < vCount; i++) {
+        start[i + 1] += start[i];
+        live[i] = start[i + 1] - start[i];
+        stamp[i] = 0;
+    }
+    for (int i = 0; i < vCount; i++) stamp[i] = start[i];
+    for (int t = 0; t < nt; t++)
+        for (int k = 0; k < 3; k++) tris[stamp[indices[t * 3 + k]]++] = t;
+    for (int i = 0; i < vCount; i++) stamp[i] = 0;
+
+    int time = cacheSize + 1, dead = 0, cursor = 0, written = 0;
+    int fan = 0;
+    while (fan < vCount && live[fan] == 0) fan++;
+    while (fan < vCount) {
+        int candFirst = dead;
+        for (int s = start[fan]; s < start[fan + 1]; s++) {
+            int t = tris[s];
+            if (emitted[t]) continue;
+            emitted[t] = 1;
+            for (int k = 0; k < 3; k++) {
+                unsigned v = indices[t * 3 + k];
+                out[written++] = v;
+                deadEnd[dead++] = (int) v;
+                live[v]--;
+                if (time - stamp[v] > cacheSize) stamp[v] = time++;
+            }
+        }
+        // best candidate: the one that stays in cache longest once its remaining triangles are
+        // emitted; a candidate that would fall out of the cache scores 0 and never beats the
+        // dead-end stack
+        int next = -1, best = 0;
+        for (int c = candFirst; c < dead; c++) {
+            int v = deadEnd[c];
+            if (live[v] <= 0) continue;
+            int p = 0;
+            if (time - stamp[v] + 2 * live[v] <= cacheSize) p = time - stamp[v];
+            if (p > best) {
+                best = p;
+                next = v;
+            }
+        }
+        if (next < 0) {
+            while (dead > 0 && next < 0) {
+                int v = deadEnd[--dead];
+                if (live[v] > 0) next = v;
+            }
+            while (next < 0 && cursor < vCount) {
+                if (live[cursor] > 0) next = cursor;
+                cursor++;
+            }
+        }
+        fan = next < 0 ? vCount : next;
+    }
+    memcpy(indices, out, sizeof(unsigned) * (size_t) nt * 3);
+    free(emitted);
+    free(block);
+}
+
+int mesh_optimize_vertex_fetch_remap(unsigned *indices, int iCount, int vCount, int *remap) {
+    for (int i = 0; i < vCount; i++) remap[i] = -1;
+    int next = 0;
+    for (int i = 0; i < iCount; i++) {
+        unsigned v = indices[i];
+        if (remap[v] < 0) remap[v] = next++;
+        indices[i] = (unsigned) remap[v];
+    }
+    int used = next;
+    for (int i = 0; i < vCount; i++) if (remap[i] < 0) remap[i] = next++;
+    return used;
+}
+
+// Spreads the low 10 bits of x so two zero bits follow each one.
+static unsigned morton_part(unsigned x) {
+    x &= 0x3ffu;
+    x = (x | (x << 16)) & 0x030000ffu;
+    x = (x | (x << 8)) & 0x0300f00fu;
+    x = (x | (x << 4)) & 0x030c30c3u;
+    x = (x | (x << 2)) & 0x09249249u;
+    return x;
+}
+
+#define MORTON_BITS 10
+#define RADIX_BITS 10
+#define RADIX_CHUNK 16384
+
+void mesh_morton_remap(const Vector3 *v, int n, int *remap, void *(*alloc)(void *, size_t, size_t), void *ud) {
+    if (n <= 0) return;
+    float mn[3], mx[3];
+    mesh_kernels()->bbox((const float *) v, n, mn, mx);
+    // one scale for all axes keeps the cells cubic, so a flat mesh still sorts along its plane
+    float extent = mx[0] - mn[0];
+    if (mx[1] - mn[1] > extent) extent = mx[1] - mn[1];
+    if (mx[2] - mn[2] > extent) extent = mx[2] - mn[2];
+    const float scale = extent > 0.0f ? (float) ((1 << MORTON_BITS) - 1) / extent : 0.0f;
+
+    // fixed-size chunks, so the order is the same for any thread count
+    const int chunks = (n + RADIX_CHUNK - 1) / RADIX_CHUNK;
+    const int buckets = 1 << RADIX_BITS;
+    int owned = 0;
+    size_t bytes = sizeof(unsigned) * 4 * (size_t) n + sizeof(int) * (size_t) chunks * (size_t) buckets;
+    void *block = mesh_scratch(alloc, ud, bytes, alignof(unsigned), &owned);
+    unsigned *key = (unsigned *) block, *keyTmp = key + n;
+    unsigned *idx = keyTmp + n, *idxTmp = idx + n;
+    int *hist = (int *) (idxTmp + n);
+
+MESH_OMP(omp parallel for schedule(static) if (n >= MESH_PAR_MIN))
+    for (int i = 0; i < n; i++) {
+        unsigned q[3];
+        const float *p = &v[i].x;
+        for (int k = 0; k < 3; k++) {
+            float t = (p[k] - mn[k]) * scale + 0.5f;
+            q[k] = t > 0.0f ? (unsigned) t : 0u;
+            if (q[k] > (1u << MORTON_BITS) - 1u) q[k] = (1u << MORTON_BITS) - 1u;
+        }
+        key[i] = morton_part(q[0]) | morton_part(q[1]) << 1 | morton_part(q[2]) << 2;
+        idx[i] = (unsigned) i;
+    }
+
+    // LSD radix sort, stable, 10 bits per pass: count per chunk, scan digit-major, scatter per chunk
+    for (int shift = 0; shift < 3 * MORTON_BITS; shift += RADIX_BITS) {
+        memset(hist, 0, sizeof(int) * (size_t) chunks * (size_t) buckets);
+MESH_OMP(omp parallel for schedule(static) if (n >= MESH_PAR_MIN))
+        for (int c = 0; c < chunks; c++) {
+            int *h = hist + (size_t) c * buckets;
+            const int end = (c + 1) * RADIX_CHUNK < n ? (c + 1) * RADIX_CHUNK : n;
+            for (int i = c * RADIX_CHUNK; i < end; i++) h[(key[i] >> shift) & (buckets - 1)]++;
+        }
+        int sum = 0;
+        for (int d = 0; d < buckets; d++)
+            for (int c = 0; c < chunks; c++) {
+                int *h = hist + (size_t) c * buckets + d;
+                int cnt = *h;
+                *h = sum;
+                sum += cnt;
+            }
+MESH_OMP(omp parallel for schedule(static) if (n >= MESH_PAR_MIN))
+        for (int c = 0; c < chunks; c++) {
+            int *h = hist + (size_t) c * buckets;
+            const int end = (c + 1) * RADIX_CHUNK < n ? (c + 1) * RADIX_CHUNK : n;
+            for (int i = c * RADIX_CHUNK; i < end; i++) {
+                int o = h[(key[i] >> shift) & (buckets - 1)]++;
+                keyTmp[o] = key[i];
+                idxTmp[o] = idx[i];
+            }
+        }
+        unsigned *t = key;
+        key = keyTmp;
+        keyTmp = t;
+        t = idx;
+        idx = idxTmp;
+        idxTmp = t;
+    }
+    for (int i = 0; i < n; i++) remap[idx[i]] = i;
+    if (owned) free(block);
+}
+
+void mesh_reorder_spatial(QMesh *m, void *(*alloc)(void *, size_t, size_t), void *ud) {
+    const int n = m->vCount;
+    if (n < 2) return;
+    int owned = 0;
+    size_t bytes = sizeof(int) * (size_t) n + sizeof(Vector3) * (size_t) n;
+    void *block = mesh_scratch(alloc, ud, bytes, alignof(Vector3), &owned);
+    Vector3 *tmp = (Vector3 *) block;
+    int *remap = (int *) (tmp + n);
+    mesh_morton_remap(m->v, n, remap, alloc, ud);
+
+    for (int i = 0; i < n; i++) tmp[remap[i]] = m->v[i];
+    memcpy(m->v, tmp, sizeof(Vector3) * (size_t) n);
+    if (m->ref) {
+        int *rtmp = (int *) tmp;
+        for (int i = 0; i < n; i++) rtmp[remap[i]] = m->ref[i];
+        memcpy(m->ref, rtmp, sizeof(int) * (size_t) n);
+    }
+    qm_touch_quads(m);
+MESH_OMP(omp parallel for schedule(static) if (m->qCount >= MESH_PAR_MIN))
+    for (int qi = 0; qi < m->qCount; qi++) {
+        Quad *q = &m->q[qi];
+        *q = (Quad) {remap[q->a], remap[q->b], remap[q->c], remap[q->d]};
+    }
+    if (owned) free(block);
+}
+
+// Index of the next corner after k (step +1) or before it (step 3) that is a different vertex,
+// so a quad with a repeated corner still measures its angles on real edges.
+static int quad_corner_step(const int *c, int k, int step) {
+    for (int s = 1; s < 4; s++) {
+        int j = (k + step * s) & 3;
+        if (c[j] != c[k]) return j;
+    }
+    return k;
+}
+
+float *mesh_vertex_normals(QMesh *m, float creaseRad, void *(*alloc)(void *, size_t, size_t), void *ud) {
+    const int nq = m->qCount, nv = m->vCount;
+    const int nc = nq * 4;
+    const QMeshAdj *adj = mesh_adjacency(m);
+    const int *start = adj->vStart, *list = adj->vCorner;
+    size_t bytes = sizeof(float) * ((size_t) nq * 3 + (size_t) nc * 3) + sizeof(int) * ((size_t) nv + (size_t) nc);
+    int owned = 0;
+    void *block = mesh_scratch(alloc, ud, bytes, alignof(float), &owned);
+    float *faceN = (float *) block;          // unit normal per quad
+    float *cornerN = faceN + (size_t) nq * 3; // area * angle weighted normal per quad corner
+    int *group = (int *) (cornerN + (size_t) nc * 3); // smooth fan of each corner at its vertex
+    int *extra = group + nc;                 // extra copies per vertex, then their first index
+    const int *corner = (const int *) m->q;
+
+MESH_OMP(omp parallel for schedule(static) if (nq >= MESH_PAR_MIN))
+    for (int qi = 0; qi < nq; qi++) {
+        const int *c = corner + qi * 4;
+        Vector3 p[4];
+        for (int k = 0; k < 4; k++) p[k] = m->v[c[k]];
+        // half the diagonals' cross product is the quad's vector area, for planar and warped quads alike
+        Vector3 n = Vector3Scale(Vector3CrossProduct(Vector3Subtract(p[2], p[0]), Vector3Subtract(p[3], p[1])), 0.5f);
+        float len = Vector3Length(n);
+        Vector3 u = len > 0.0f ? Vector3Scale(n, 1.0f / len) : (Vector3) {0, 0, 0};
+        faceN[qi * 3 + 0] = u.x, faceN[qi * 3 + 1] = u.y, faceN[qi * 3 + 2] = u.z;
+        for (int k = 0; k < 4; k++) {
+            float w = 0.0f;
+            // a repeated corner is counted once, at its first occurrence
+            if (c[k] != c[(k + 3) & 3]) {
+                Vector3 e0 = Vector3Subtract(p[quad_corner_step(c, k, 1)], p[k]);
+                Vector3 e1 = Vector3Subtract(p[quad_corner_step(c, k, 3)], p[k]);
+                float l = Vector3Length(e0) * Vector3Length(e1);
+                if (l > 0.0f) w = acosf(Clamp(Vector3DotProduct(e0, e1) / l, -1.0f, 1.0f));
+            }
+            float *o = cornerN + ((size_t) qi * 4 + (size_t) k) * 3;
+            o[0] = n.x * w, o[1] = n.y * w, o[2] = n.z * w;
+        }
+    }
+
+    // greedy fans: a corner joins the first fan whose first face is within the crease angle
+    const float cosCrease = cosf(creaseRad);
+MESH_OMP(omp parallel for schedule(static) if (nv >= MESH_PAR_MIN))
+    for (int i = 0; i < nv; i++) {
+        int fans = 0;
+        for (int s = start[i]; s < start[i + 1]; s++) {
+            int c = list[s], g = 0;
+            if (creaseRad > 0.0f) {
+                const float *f = faceN + (c >> 2) * 3;
+                for (g = 0; g < fans; g++) {
+                    int seed = -1;
+                    for (int t = start[i]; t < s && seed < 0; t++) if (group[list[t]] == g) seed = list[t];
+                    const float *sf = faceN + (seed >> 2) * 3;
+                    float d = f[0] * sf[0] + f[1] * sf[1] + f[2] * sf[2];
+                    bool flat = (f[0] == 0.0f && f[1] == 0.0f && f[2] == 0.0f) ||
+                                (sf[0] == 0.0f && sf[1] == 0.0f && sf[2] == 0.0f);
+                    if (flat || d >= cosCrease) break;
+                }
+            }
+            group[c] = g;
+            if (g == fans) fans++;
+        }
+        extra[i] = fans > 1 ? fans - 1 : 0;
+    }
+
+    int added = 0;
+    for (int i = 0; i < nv; i++) {
+        int e = extra[i];
+        extra[i] = nv + added;
+        added += e;
+    }
+    if (added) {
+        qm_reserve(m, nv + added, 0);
+        for (int i = 0; i < nv; i++) {
+            int e = (i + 1 < nv ? extra[i + 1] : nv + added) - extra[i];
+            for (int k = 0; k < e; k++) {
+                if (m->ref) m->ref[extra[i] + k] = -1;
+                m->v[extra[i] + k] = m->v[i];
+            }
+        }
+        m->vCount = nv + added;
+    }
+
+    float *out = (float *) malloc(sizeof(float) * 3 * (size_t) (nv + added));
+    if (!out && nv + added) abort();
+    int *qc = (int *) m->q;
+MESH_OMP(omp parallel for schedule(static) if (nv >= MESH_PAR_MIN))
+    for (int i = 0; i < nv; i++) {
+        int fans = (i + 1 < nv ? extra[i + 1] : nv + added) - extra[i] + 1;
+        for (int g = 0; g < fans; g++) {
+            int dst = g == 0 ? i : extra[i] + g - 1;
+            float sx = 0.0f, sy = 0.0f, sz = 0.0f;
+            for (int s = start[i]; s < start[i + 1]; s++) {
+                int c = list[s];
+                if (group[c] != g) continue;
+                sx += cornerN[(size_t) c * 3 + 0];
+                sy += cornerN[(size_t) c * 3 + 1];
+                sz += cornerN[(size_t) c * 3 + 2];
+                qc[c] = dst;
+            }
+            float len = sqrtf(sx * sx + sy * sy + sz * sz);
+            float *o = out + (size_t) dst * 3;
+            if (len > 0.0f) o[0] = sx / len, o[1] = sy / len, o[2] = sz / len;
+            else o[0] = 0.0f, o[1] = 0.0f, o[2] = 1.0f;
+        }
+    }
+
+    // split corners were re-pointed in place; the adjacency read above is stale from here on
+    if (added) qm_touch_quads(m);
+    if (owned) free(block);
+    return out;
+}
+
+// Bounds of an instanced mesh without flattening it: identity and pure translations shift the
+// bases' cached bounds, anything else walks the base's vertices. mesh_bbox caches the result on
+// m like a plain mesh's bounds, so the walk happens once per set of instances.
+static void mesh_bbox_insts(const QMesh *m, float mn[3], float mx[3]) {
+    for (int k = 0; k < 3; k++) {
+        mn[k] = INFINITY;
+        mx[k] = -INFINITY;
+    }
+    for (int i = 0; i < m->instCount; i++) {
+        const QMeshInst *in = &m->inst[i];
+        if (in->base->vCount == 0) continue;
+        const float *r = in->xf;
+        float bmn[3], bmx[3];
+        if (r[0] == 1.0f && r[1] == 0.0f && r[2] == 0.0f && r[4] == 0.0f && r[5] == 1.0f && r[6] == 0.0f &&
+            r[8] == 0.0f && r[9] == 0.0f && r[10] == 1.0f) {
+            mesh_bbox(in->base, bmn, bmx);
+            for (int k = 0; k < 3; k++) {
+                bmn[k] += r[k * 4 + 3];
+                bmx[k] += r[k * 4 + 3];
+            }
+        } else {
+            for (int k = 0; k < 3; k++) {
+                bmn[k] = INFINITY;
+                bmx[k] = -INFINITY;
+            }
+            for (int j = 0; j < in->base->vCount; j++) {
+                Vector3 p = in->base->v[j];
+                for (int k = 0; k < 3; k++) {
+                    const float *row = r + k * 4;
+                    float c = row[0] * p.x + row[1] * p.y + row[2] * p.z + row[3];
+                    if (c < bmn[k]) bmn[k] = c;
+                    if (c > bmx[k]) bmx[k] = c;
+                }
+            }
+        }
+        for (int k = 0; k < 3; k++) {
+            if (bmn[k] < mn[k]) mn[k] = bmn[k];
+            if (bmx[k] > mx[k]) mx[k] = bmx[k];
+        }
+    }
+    if (mn[0] > mx[0]) mn[0] = mn[1] = mn[2] = mx[0] = mx[1] = mx[2] = 0.0f;
+}
+
+void mesh_bbox(const QMesh *m, float mn[3], float mx[3]) {
+    if (!m || (m->vCount == 0 && m->instCount == 0)) {
+        mn[0] = mn[1] = mn[2] = mx[0] = mx[1] = mx[2] = 0.0f;
+        return;
+    }
+    if (!m->bbValid) {
+        // the cache is not part of the mesh's observable state, so filling it through a const mesh is fine
+        QMesh *w = (QMesh *) m;
+        if (m->instCount) mesh_bbox_insts(m, w->bbMin, w->bbMax);
+        else mesh_kernels()->bbox((const float *) m->v, m->vCount, w->bbMin, w->bbMax);
+        w->bbValid = true;
+    }
+    memcpy(mn, m->bbMin, sizeof(float) * 3);
+    memcpy(mx, m->bbMax, sizeof(float) * 3);
+}
+
+void mesh_bbox_minmax(const QMesh *m, float *minx, float *miny, float *minz,
+                      float *maxx, float *maxy, float *maxz) {
+    float mn[3], mx[3];
+    mesh_bbox(m, mn, mx);
+    *minx = mn[0];
+    *miny = mn[1];
+    *minz = mn[2];
+    *maxx = mx[0];
+    *maxy = mx[1];
+    *maxz = mx[2];
+}
@@ -0,0 +1,512 @@
+#include "mesh.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <stdalign.h>
+
+// Bounding volume hierarchy over a QMesh's quads. Nodes live in one block with the quad order
+// they index; a node's children are adjacent, so an inner node only stores where they start.
+// Quads are tested as triangles a-b-c and a-c-d. An instanced mesh is indexed through a
+// flattened copy kept with its BVH, so queries leave its instances alone.
+
+#define BVH_BINS 16
+#define BVH_LEAF_MAX 4
+#define BVH_STACK 64
+
+typedef struct {
+    float mn[3], mx[3];
+    int first;  // leaf: first entry of prim; inner: index of the left child (right follows)
+    int count;  // quads in a leaf, 0 for an inner node
+} BVHNode;
+
+typedef struct QMeshBVH {
+    int vCount, qCount, instCount;  // what the mesh held when this was built
+    int nodeCount;
+    int depth;  // of the deepest node, the root being 0; sizes the traversal stacks
+    BVHNode *node;
+    int *prim;
+    QMesh flat;  // the quads indexed for an instanced mesh; empty otherwise
+} QMeshBVH;
+
+typedef struct {
+    float mn[3], mx[3];
+} BVHBox;
+
+static void box_empty(BVHBox *b) {
+    for (int k = 0; k < 3; k++) {
+        b->mn[k] = FLT_MAX;
+        b->mx[k] = -FLT_MAX;
+    }
+}
+
+static void box_grow(BVHBox *b, const float *mn, const float *mx) {
+    for (int k = 0; k < 3; k++) {
+        if (mn[k] < b->mn[k]) b->mn[k] = mn[k];
+        if (mx[k] > b->mx[k]) b->mx[k] = mx[k];
+    }
+}
+
+static float box_area(const BVHBox *b) {
+    float dx = b->mx[0] - b->mn[0], dy = b->mx[1] - b->mn[1], dz = b->mx[2] - b->mn[2];
+    if (dx < 0 || dy < 0 || dz < 0) return 0.0f;
+    return dx * dy + dy * dz + dz * dx;
+}
+
+// Traversal stacks hold the node being opened plus at most one pending sibling per level
+// below it, so a depth bound sizes them; deep trees spill to the heap.
+static void *bvh_stack(void *local, size_t localBytes, size_t bytes) {
+    if (bytes <= localBytes) return local;
+    void *p = malloc(bytes);
+    if (!p) abort();
+    return p;
+}
+
+// Binned SAH build (Wald 2007): split the longest centroid axis at the cheapest of BVH_BINS - 1
+// bin boundaries, or make a leaf when no split beats testing every quad. The block lives on the
+// system heap like the adjacency, whatever m's allocator is.
+static QMeshBVH *bvh_build(const QMesh *m) {
+    const int nq = m->qCount;
+    const int maxNodes = nq > 0 ? nq * 2 - 1 : 1;
+    size_t bytes = sizeof(QMeshBVH) + sizeof(BVHNode) * (size_t) maxNodes + sizeof(int) * (size_t) nq;
+    QMeshBVH *B = (QMeshBVH *) malloc(bytes);
+    if (!B) abort();
+    memset(B, 0, sizeof(*B));
+    B->vCount = m->vCount;
+    B->qCount = nq;
+    B->node = (BVHNode *) (B + 1);
+    B->prim = (int *) (B->node + maxNodes);
+    B->nodeCount = 1;
+    BVHNode *root = &B->node[0];
+    root->first = 0;
+    root->count = nq;
+    if (nq == 0) {
+        for (int k = 0; k < 3; k++) root->mn[k] = root->mx[k] = 0.0f;
+        return B;
+    }
+
+    BVHBox *qb = (BVHBox *) malloc(sizeof(BVHBox) * (size_t) nq);
+    float *cen = (float *) malloc(sizeof(float) * 3 * (size_t) nq);
+    if (!qb || !cen) abort();
+    const Vector3 *v = m->v;
+    for (int i = 0; i < nq; i++) {
+        const int *c = (const int *) &m->q[i];
+        box_empty(&qb[i]);
+        for (int k = 0; k < 4; k++) {
+            const float *p = (const float *) &v[c[k]];
+            box_grow(&qb[i], p, p);
+        }
+        for (int k = 0; k < 3; k++) cen[i * 3 + k] = (qb[i].mn[k] + qb[i].mx[k]) * 0.5f;
+        B->prim[i] = i;
+    }
+
+    // every pending node owns at least one quad of its own, so nq entries never overflow
+    int *stack = (int *) malloc(sizeof(int) * 2 * (size_t) nq), sp = 0;
+    if (!stack) abort();
+    stack[sp++] = 0;
+    stack[sp++] = 0;
+    while (sp > 0) {
+        const int depth = stack[--sp];
+        BVHNode *n = &B->node[stack[--sp]];
+        if (depth > B->depth) B->depth = depth;
+        BVHBox nb, cb;
+        box_empty(&nb);
+        box_empty(&cb);
+        for (int i = n->first; i < n->first + n->count; i++) {
+            int p = B->prim[i];
+            box_grow(&nb, qb[p].mn, qb[p].mx);
+            box_grow(&cb, cen + p * 3, cen + p * 3);
+        }
+        memcpy(n->mn, nb.mn, sizeof(n->mn));
+        memcpy(n->mx, nb.mx, sizeof(n->mx));
+        if (n->count <= BVH_LEAF_MAX) continue;
+
+        int axis = 0;
+        for (int k = 1; k < 3; k++)
+            if (cb.mx[k] - cb.mn[k] > cb.mx[axis] - cb.mn[axis]) axis = k;
+        float lo = cb.mn[axis], ext = cb.mx[axis] - lo;
+        if (ext <= 0.0f) continue;  // every centroid in one spot: no split separates them
+
+        BVHBox bin[BVH_BINS];
+        int binCount[BVH_BINS] = {0};
+        for (int b = 0; b < BVH_BINS; b++) box_empty(&bin[b]);
+        const float scale = (float) BVH_BINS / ext;
+        for (int i = n->first; i < n->first + n->count; i++) {
+            int p = B->prim[i];
+            int b = (int) ((cen[p * 3 + axis] - lo) * scale);
+            if (b >= BVH_BINS) b = BVH_BINS - 1;
+            binCount[b]++;
+            box_grow(&bin[b], qb[p].mn, qb[p].mx);
+        }
+        // sweep from the right for suffix areas, then from the left for the cost at each plane
+        float rightArea[BVH_BINS];
+        int rightCount[BVH_BINS];
+        BVHBox acc;
+        box_empty(&acc);
+        int cnt = 0;
+        for (int b = BVH_BINS - 1; b > 0; b--) {
+            box_grow(&acc, bin[b].mn, bin[b].mx);
+            cnt += binCount[b];
+            rightArea[b] = box_area(&acc);
+            rightCount[b] = cnt;
+        }
+        box_empty(&acc);
+        cnt = 0;
+        int bestSplit = -1;
+        float bestCost = (float) n->count * box_area(&nb);
+        for (int b = 1; b < BVH_BINS; b++) {
+            box_grow(&acc, bin[b - 1].mn, bin[b - 1].mx);
+            cnt += binCount[b - 1];
+            if (cnt == 0 || rightCount[b] == 0) continue;
+            float cost = (float) cnt * box_area(&acc) + (float) rightCount[b] * rightArea[b];
+            if (cost < bestCost) {
+                bestCost = cost;
+                bestSplit = b;
+            }
+        }
+        if (bestSplit < 0) continue;
+
+        int i = n->first, j = n->first + n->count - 1;
+        while (i <= j) {
+            int p = B->prim[i];
+            int b = (int) ((cen[p * 3 + axis] - lo) * scale);
+            if (b >= BVH_BINS) b = BVH_BINS - 1;
+            if (b < bestSplit) {
+                i++;
+            } else {
+                B->prim[i] = B->prim[j];
+                B->prim[j--] = p;
+            }
+        }
+        int leftCount = i - n->first;
+        int l = B->nodeCount;
+        B->nodeCount += 2;
+        B->node[l].first = n->first;
+        B->node[l].count = leftCount;
+        B->node[l + 1].first = i;
+        B->node[l + 1].count = n->count - leftCount;
+        n->first = l;
+        n->count = 0;
+        stack[sp++] = l + 1;
+        stack[sp++] = depth + 1;
+        stack[sp++] = l;
+        stack[sp++] = depth + 1;
+    }
+    free(stack);
+    free(cen);
+    free(qb);
+    return B;
+}
+
+void mesh_bvh_free(struct QMeshBVH *B) {
+    if (!B) return;
+    qm_free(&B->flat);
+    free(B);
+}
+
+static const QMeshBVH *mesh_bvh(const QMesh *m) {
+    const QMeshBVH *B = m->bvh;
+    if (B && B->vCount == m->vCount && B->qCount == m->qCount && B->instCount == m->instCount) return B;
+    // a query cache like the adjacency; building it through a const mesh is fine
+    QMesh *w = (QMesh *) m;
+    mesh_bvh_free(w->bvh);
+    if (m->instCount == 0) {
+        w->bvh = bvh_build(m);
+    } else {
+        QMesh flat;
+        qm_init(&flat);
+        mesh_merge(&flat, m);
+        w->bvh = bvh_build(&flat);
+        w->bvh->flat = flat;
+    }
+    w->bvh->vCount = m->vCount;
+    w->bvh->qCount = m->qCount;
+    w->bvh->instCount = m->instCount;
+    return w->bvh;
+}
+
+// The quads B indexes: m's own, or the flattened copy of its instances.
+static const QMesh *bvh_geom(const QMesh *m, const QMeshBVH *B) {
+    return m->instCount ? &B->flat : m;
+}
+
+static void quad_tri(const QMesh *m, int qi, int t, Vector3 p[3]) {
+    const Quad q = m->q[qi];
+    p[0] = m->v[q.a];
+    p[1] = m->v[t ? q.c : q.b];
+    p[2] = m->v[t ? q.d : q.c];
+}
+
+// Möller-Trumbore; returns the distance along d, or a negative value on a miss.
+static float ray_tri(Vector3 o, Vector3 d, const Vector3 p[3]) {
+    Vector3 e1 = Vector3Subtract(p[1], p[0]), e2 = Vector3Subtract(p[2], p[0]);
+    Vector3 h = Vector3CrossProduct(d, e2);
+    float det = Vector3DotProduct(e1, h);
+    if (fabsf(det) < 1e-12f) return -1.0f;
+    float inv = 1.0f / det;
+    Vector3 s = Vector3Subtract(o, p[0]);
+    float u = Vector3DotProduct(s, h) * inv;
+    if (u < 0.0f || u > 1.0f) return -1.0f;
+    Vector3 qv = Vector3CrossProduct(s, e1);
+    float w = Vector3DotProduct(d, qv) * inv;
+    if (w < 0.0f || u + w > 1.0f) return -1.0f;
+    return Vector3DotProduct(e2, qv) * inv;
+}
+
+// Slab test against [0, tMax]; returns the entry distance or FLT_MAX on a miss.
+static float ray_box(const float o[3], const float inv[3], const BVHNode *n, float tMax) {
+    float t0 = 0.0f, t1 = tMax;
+    for (int k = 0; k < 3; k++) {
+        float a = (n->mn[k] - o[k]) * inv[k], b = (n->mx[k] - o[k]) * inv[k];
+        if (a > b) {
+            float t = a;
+            a = b;
+            b = t;
+        }
+        if (a > t0) t0 = a;
+        if (b < t1) t1 = b;
+        if (t0 > t1) return FLT_MAX;
+    }
+    return t0;
+}
+
+typedef struct {
+    int node;
+    float t;  // entry distance when pushed
+} BVHRayEntry;
+
+bool mesh_raycast(const QMesh *m, Vector3 o, Vector3 d, float tMax, QMeshHit *hit) {
+    if (m->qCount == 0 && m->instCount == 0) return false;
+    const QMeshBVH *B = mesh_bvh(m);
+    m = bvh_geom(m, B);
+    if (m->qCount == 0) return false;
+    const float of[3] = {o.x, o.y, o.z};
+    const float df[3] = {d.x, d.y, d.z};
+    float inv[3];
+    // IEEE infinities make the slab test work for axis-parallel rays
+    for (int k = 0; k < 3; k++) inv[k] = 1.0f / df[k];
+    float best = tMax;
+    int bestQuad = -1;
+    float t0 = ray_box(of, inv, &B->node[0], best);
+    if (t0 == FLT_MAX) return false;
+    BVHRayEntry local[BVH_STACK];
+    BVHRayEntry *stack = (BVHRayEntry *) bvh_stack(local, sizeof(local), sizeof(BVHRayEntry) * (size_t) (B->depth + 1));
+    int sp = 0;
+    stack[sp++] = (BVHRayEntry) {0, t0};
+    while (sp > 0) {
+        const BVHRayEntry e = stack[--sp];
+        // a hit found since the push may already be nearer than this box
+        if (e.t >= best) continue;
+        const BVHNode *n = &B->node[e.node];
+        if (n->count > 0) {
+            for (int i = n->first; i < n->first + n->count; i++) {
+                for (int t = 0; t < 2; t++) {
+                    Vector3 p[3];
+                    quad_tri(m, B->prim[i], t, p);
+                    float h = ray_tri(o, d, p);
+                    if (h >= 0.0f && h < best) {
+                        best = h;
+                        bestQuad = B->prim[i];
+                    }
+                }
+            }
+            continue;
+        }
+        float tl = ray_box(of, inv, &B->node[n->first], best);
+        float tr = ray_box(of, inv, &B->node[n->first + 1], best);
+        // the nearer child goes on top so it can shrink `best` before the other is opened
+        if (tl <= tr) {
+            if (tr != FLT_MAX) stack[sp++] = (BVHRayEntry) {n->first + 1, tr};
+            if (tl != FLT_MAX) stack[sp++] = (BVHRayEntry) {n->first, tl};
+        } else {
+            if (tl != FLT_MAX) stack[sp++] = (BVHRayEntry) {n->first, tl};
+            stack[sp++] = (BVHRayEntry) {n->first + 1, tr};
+        }
+    }
+    if (stack != local) free(stack);
+    if (bestQuad < 0) return false;
+    if (hit) {
+        hit->t = best;
+        hit->quad = bestQuad;
+        hit->p = Vector3Add(o, Vector3Scale(d, best));
+    }
+    return true;
+}
+
+static Vector3 closest_on_segment(Vector3 p, Vector3 a, Vector3 b) {
+    Vector3 ab = Vector3Subtract(b, a);
+    float l2 = Vector3DotProduct(ab, ab);
+    float t = l2 > 0.0f ? Vector3DotProduct(Vector3Subtract(p, a), ab) / l2 : 0.0f;
+    t = t < 0.0f ? 0.0f : (t > 1.0f ? 1.0f : t);
+    return Vector3Add(a, Vector3Scale(ab, t));
+}
+
+// Ericson, Real-Time Collision Detection 5.1.5; zero-area triangles fall back to their edges.
+static Vector3 closest_on_tri(Vector3 p, const Vector3 t[3]) {
+    Vector3 a = t[0], b = t[1], c = t[2];
+    Vector3 ab = Vector3Subtract(b, a), ac = Vector3Subtract(c, a), ap = Vector3Subtract(p, a);
+    Vector3 n = Vector3CrossProduct(ab, ac);
+    if (Vector3DotProduct(n, n) <= 0.0f) {
+        Vector3 best = closest_on_segment(p, a, b);
+        Vector3 cand[2] = {closest_on_segment(p, b, c), closest_on_segment(p, c, a)};
+        for (int i = 0; i < 2; i++)
+            if (Vector3DistanceSqr(p, cand[i]) < Vector3DistanceSqr(p, best)) best = cand[i];
+        return best;
+    }
+    float d1 = Vector3DotProduct(ab, ap), d2 = Vector3DotProduct(ac, ap);
+    if (d1 <= 0.0f && d2 <= 0.0f) return a;
+    Vector3 bp = Vector3Subtract(p, b);
+    float d3 = Vector3DotProduct(ab, bp), d4 = Vector3DotProduct(ac, bp);
+    if (d3 >= 0.0f && d4 <= d3) return b;
+    float vc = d1 * d4 - d3 * d2;
+    if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f) return Vector3Add(a, Vector3Scale(ab, d1 / (d1 - d3)));
+    Vector3 cp = Vector3Subtract(p, c);
+    float d5 = Vector3DotProduct(ab, cp), d6 = Vector3DotProduct(ac, cp);
+    if (d6 >= 0.0f && d5 <= d6) return c;
+    float vb = d5 * d2 - d1 * d6;
+    if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f) return Vector3Add(a, Vector3Scale(ac, d2 / (d2 - d6)));
+    float va = d3 * d6 - d5 * d4;
+    if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f)
+        return Vector3Add(b, Vector3Scale(Vector3Subtract(c, b), (d4 - d3) / ((d4 - d3) + (d5 - d6))));
+    float denom = 1.0f / (va + vb + vc);
+    return Vector3Add(a, Vector3Add(Vector3Scale(ab, vb * denom), Vector3Scale(ac, vc * denom)));
+}
+
+static float box_dist2(Vector3 p, const BVHNode *n) {
+    const float pf[3] = {p.x, p.y, p.z};
+    float d2 = 0.0f;
+    for (int k = 0; k < 3; k++) {
+        float d = pf[k] < n->mn[k] ? n->mn[k] - pf[k] : (pf[k] > n->mx[k] ? pf[k] - n->mx[k] : 0.0f);
+        d2 += d * d;
+    }
+    return d2;
+}
+
+bool mesh_closest_point(const QMesh *m, Vector3 p, float maxDist, QMeshHit *hit) {
+    if (m->qCount == 0 && m->instCount == 0) return false;
+    const QMeshBVH *B = mesh_bvh(m);
+    m = bvh_geom(m, B);
+    if (m->qCount == 0) return false;
+    float best = maxDist * maxDist;
+    int bestQuad = -1;
+    Vector3 bestP = p;
+    int local[BVH_STACK];
+    int *stack = (int *) bvh_stack(local, sizeof(local), sizeof(int) * (size_t) (B->depth + 1)), sp = 0;
+    stack[sp++] = 0;
+    while (sp > 0) {
+        const BVHNode *n = &B->node[stack[--sp]];
+        if (box_dist2(p, n) > best) continue;
+        if (n->count > 0) {
+            for (int i = n->first; i < n->first + n->count; i++) {
+                for (int t = 0; t < 2; t++) {
+                    Vector3 tri[3];
+                    quad_tri(m, B->prim[i], t, tri);
+                    Vector3 c = closest_on_tri(p, tri);
+                    float d2 = Vector3DistanceSqr(p, c);
+                    if (d2 <= best) {
+                        best = d2;
+                        bestQuad = B->prim[i];
+                        bestP = c;
+                    }
+                }
+            }
+            continue;
+        }
+        float dl = box_dist2(p, &B->node[n->first]), dr = box_dist2(p, &B->node[n->first + 1]);
+        if (dl <= dr) {
+            stack[sp++] = n->first + 1;
+            stack[sp++] = n->first;
+        } else {
+            stack[sp++] = n->first;
+            stack[sp++] = n->first + 1;
+        }
+    }
+    if (stack != local) free(stack);
+    if (bestQuad < 0) return false;
+    if (hit) {
+        hit->t = sqrtf(best);
+        hit->quad = bestQuad;
+        hit->p = bestP;
+    }
+    return true;
+}
+
+// Edge p0-p1 against triangle t, including both end points.
+static bool segment_tri(Vector3 p0, Vector3 p1, const Vector3 t[3]) {
+    float h = ray_tri(p0, Vector3Subtract(p1, p0), t);
+    return h >= 0.0f && h <= 1.0f;
+}
+
+// Non-coplanar triangles intersect exactly when an edge of one crosses the other.
+static bool tri_tri(const Vector3 a[3], const Vector3 b[3]) {
+    for (int k = 0; k < 3; k++) {
+        if (segment_tri(a[k], a[(k + 1) % 3], b)) return true;
+        if (segment_tri(b[k], b[(k + 1) % 3], a)) return true;
+    }
+    return false;
+}
+
+static bool node_overlap(const BVHNode *x, const BVHNode *y) {
+    for (int k = 0; k < 3; k++)
+        if (x->mn[k] > y->mx[k] || y->mn[k] > x->mx[k]) return false;
+    return true;
+}
+
+static bool leaf_pair_overlaps(const QMesh *a, const QMeshBVH *A, const BVHNode *x, const QMesh *b,
+                               const QMeshBVH *B, const BVHNode *y) {
+    for (int i = x->first; i < x->first + x->count; i++)
+        for (int j = y->first; j < y->first + y->count; j++)
+            for (int s = 0; s < 2; s++) {
+                Vector3 ta[3];
+                quad_tri(a, A->prim[i], s, ta);
+                for (int t = 0; t < 2; t++) {
+                    Vector3 tb[3];
+                    quad_tri(b, B->prim[j], t, tb);
+                    if (tri_tri(ta, tb)) return true;
+                }
+            }
+    return false;
+}
+
+bool mesh_overlaps(const QMesh *a, const QMesh *b) {
+    if ((a->qCount == 0 && a->instCount == 0) || (b->qCount == 0 && b->instCount == 0)) return false;
+    const QMeshBVH *A = mesh_bvh(a), *B = mesh_bvh(b);
+    a = bvh_geom(a, A);
+    b = bvh_geom(b, B);
+    if (a->qCount == 0 || b->qCount == 0) return false;
+    if (!node_overlap(&A->node[0], &B->node[0])) return false;
+    // pairs of nodes; the larger one of a pair is opened first. Each split deepens one side,
+    // so at most depthA + depthB + 1 pairs are pending
+    int local[BVH_STACK * 2];
+    int *stack = (int *) bvh_stack(local, sizeof(local), sizeof(int) * 2 * (size_t) (A->depth + B->depth + 1));
+    int sp = 0;
+    bool hitAny = false;
+    stack[sp++] = 0;
+    stack[sp++] = 0;
+    while (sp > 0) {
+        const BVHNode *y = &B->node[stack[--sp]];
+        const BVHNode *x = &A->node[stack[--sp]];
+        if (x->count > 0 && y->count > 0) {
+            if (leaf_pair_overlaps(a, A, x, b, B, y)) {
+                hitAny = true;
+                break;
+            }
+            continue;
+        }
+        BVHBox xb, yb;
+        memcpy(xb.mn, x->mn, sizeof(xb.mn));
+        memcpy(xb.mx, x->mx, sizeof(xb.mx));
+        memcpy(yb.mn, y->mn, sizeof(yb.mn));
+        memcpy(yb.mx, y->mx, sizeof(yb.mx));
+        bool splitA = y->count > 0 || (x->count == 0 && box_area(&xb) >= box_area(&yb));
+        for (int c = 0; c < 2; c++) {
+            const BVHNode *cx = splitA ? &A->node[x->first + c] : x;
+            const BVHNode *cy = splitA ? y : &B->node[y->first + c];
+            if (!node_overlap(cx, cy)) continue;
+            stack[sp++] = (int) (cx - A->node);
+            stack[sp++] = (int) (cy - B->node);
+        }
+    }
+    if (stack != local) free(stack);
+    return hitAny;
+}
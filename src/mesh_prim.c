@@ -0,0 +1,287 @@
+#include "mesh.h"
+#include <stdlib.h>
+#include <math.h>
+
+// Parametric primitives written straight into a QMesh: vertex and quad counts are known up front,
+// so each one reserves once and emits shared (already welded) vertices. Quads wind counter-
+// clockwise seen from outside, like stitch().
+
+// Vertices and quads a cap over a segs-vertex rim adds: a Coons grid like cap_plane when segs is
+// a multiple of 4, otherwise a fan of triangles (quads with a repeated centre corner).
+static void disc_counts(int segs, int *nv, int *nq) {
+    if (segs % 4 == 0) {
+        int k = segs / 4;
+        *nv = (k - 1) * (k - 1);
+        *nq = k * k;
+    } else {
+        *nv = 1;
+        *nq = segs;
+    }
+}
+
+// Caps the planar loop rim0 .. rim0 + segs - 1. Quads keep the loop's winding when up is set
+// and reverse it otherwise.
+static void disc(QMesh *m, int rim0, int segs, bool up) {
+    if (segs % 4 != 0) {
+        Vector3 c = (Vector3) {0, 0, 0};
+        for (int i = 0; i < segs; i++) c = Vector3Add(c, m->v[rim0 + i]);
+        int ci = qm_addv(m, Vector3Scale(c, 1.0f / (float) segs));
+        for (int i = 0; i < segs; i++) {
+            int a = rim0 + i, b = rim0 + (i + 1) % segs;
+            if (up) qm_addq(m, ci, a, b, ci);
+            else qm_addq(m, ci, b, a, ci);
+        }
+        return;
+    }
+    // the same boundary walk and bilinear blend as cap_plane_build
+    const int k = segs / 4, gw = k + 1;
+    const Vector3 *v = m->v;
+    int *grid = (int *) malloc(sizeof(int) * (size_t) gw * (size_t) gw);
+    if (!grid) abort();
+    for (int j = 0; j <= k; j++) {
+        for (int i = 0; i <= k; i++) {
+            int id = j * gw + i;
+            if (j == k) grid[id] = rim0 + 2 * k + (k - i);
+            else if (j == 0) grid[id] = rim0 + i;
+            else if (i == 0) grid[id] = rim0 + (3 * k + (k - j)) % segs;
+            else if (i == k) grid[id] = rim0 + k + j;
+            else grid[id] = -1;
+        }
+    }
+    for (int j = 1; j < k; j++) {
+        for (int i = 1; i < k; i++) {
+            float u = (float) i / (float) k, w = (float) j / (float) k;
+            Vector3 C0 = v[grid[j * gw]], C1 = v[grid[j * gw + k]];
+            Vector3 D0 = v[grid[i]], D1 = v[grid[k * gw + i]];
+            Vector3 P00 = v[grid[0]], P10 = v[grid[k]], P01 = v[grid[k * gw]], P11 = v[grid[k * gw + k]];
+            Vector3 BL = Vector3Lerp(Vector3Lerp(P00, P10, u), Vector3Lerp(P01, P11, u), w);
+            Vector3 P = Vector3Subtract(Vector3Add(Vector3Lerp(C0, C1, u), Vector3Lerp(D0, D1, w)), BL);
+            grid[j * gw + i] = qm_addv(m, P);
+            v = m->v;
+        }
+    }
+    for (int j = 0; j < k; j++) {
+        for (int i = 0; i < k; i++) {
+            int A = grid[j * gw + i], B = grid[j * gw + i + 1];
+            int C = grid[(j + 1) * gw + i + 1], D = grid[(j + 1) * gw + i];
+            if (up) qm_addq(m, A, B, C, D);
+            else qm_addq(m, D, C, B, A);
+        }
+    }
+    free(grid);
+}
+
+static int circle(QMesh *m, float r, float z, int segs) {
+    int first = m->vCount;
+    for (int i = 0; i < segs; i++) {
+        float t = (float) i / (float) segs * 2.0f * PI;
+        qm_addv(m, (Vector3) {r * cosf(t), r * sinf(t), z});
+    }
+    return first;
+}
+
+// Quads between two rims of segs vertices each, like stitch(a, b).
+static void band(QMesh *m, int a0, int b0, int segs) {
+    for (int i = 0; i < segs; i++) {
+        int j = (i + 1) % segs;
+        qm_addq(m, a0 + i, a0 + j, b0 + j, b0 + i);
+    }
+}
+
+void mesh_cylinder(QMesh *m, float r, float len, int segs, int rings, bool caps) {
+    if (segs < 3 || rings < 1) return;
+    int dv = 0, dq = 0;
+    if (caps) disc_counts(segs, &dv, &dq);
+    qm_reserve(m, m->vCount + segs * (rings + 1) + dv * 2, m->qCount + segs * rings + dq * 2);
+    int first = m->vCount;
+    for (int k = 0; k <= rings; k++) circle(m, r, len * (float) k / (float) rings, segs);
+    for (int k = 0; k < rings; k++) band(m, first + k * segs, first + (k + 1) * segs, segs);
+    if (caps) {
+        disc(m, first, segs, false);
+        disc(m, first + rings * segs, segs, true);
+    }
+}
+
+void mesh_tube(QMesh *m, float rOuter, float rInner, float len, int segs, bool caps) {
+    if (segs < 3) return;
+    qm_reserve(m, m->vCount + segs * 4, m->qCount + segs * (caps ? 4 : 2));
+    int o0 = circle(m, rOuter, 0.0f, segs), o1 = circle(m, rOuter, len, segs);
+    int i0 = circle(m, rInner, 0.0f, segs), i1 = circle(m, rInner, len, segs);
+    band(m, o0, o1, segs);
+    band(m, i1, i0, segs);  // the inner wall faces the axis
+    if (caps) {
+        band(m, o1, i1, segs);
+        band(m, i0, o0, segs);
+    }
+}
+
+// Vertex of a (segs+1)^3 lattice on the surface of the unit cube, or -1 inside.
+static int *cube_lattice(QMesh *m, int segs, bool sphere, float sx, float sy, float sz) {
+    const int n = segs + 1;
+    int *id = (int *) malloc(sizeof(int) * (size_t) n * (size_t) n * (size_t) n);
+    if (!id) abort();
+    for (int z = 0; z < n; z++) {
+        for (int y = 0; y < n; y++) {
+            for (int x = 0; x < n; x++) {
+                int *slot = &id[(z * n + y) * n + x];
+                if (x > 0 && x < segs && y > 0 && y < segs && z > 0 && z < segs) {
+                    *slot = -1;
+                    continue;
+                }
+                float c[3] = {(float) x / (float) segs * 2.0f - 1.0f, (float) y / (float) segs * 2.0f - 1.0f,
+                              (float) z / (float) segs * 2.0f - 1.0f};
+                Vector3 p;
+                if (sphere) {
+                    // tan warp evens out the quad sizes once the cube is pushed onto the sphere
+                    for (int k = 0; k < 3; k++) c[k] = tanf(c[k] * PI * 0.25f);
+                    p = Vector3Scale(Vector3Normalize((Vector3) {c[0], c[1], c[2]}), sx);
+                } else {
+                    p = (Vector3) {c[0] * sx * 0.5f, c[1] * sy * 0.5f, c[2] * sz * 0.5f};
+                }
+                *slot = qm_addv(m, p);
+            }
+        }
+    }
+    return id;
+}
+
+static void cube_faces(QMesh *m, const int *id, int segs) {
+    const int n = segs + 1;
+    for (int axis = 0; axis < 3; axis++) {
+        // e_b x e_c = e_axis, so (b, c) runs counter-clockwise around the +axis face
+        const int b = (axis + 1) % 3, c = (axis + 2) % 3;
+        for (int side = 0; side < 2; side++) {
+            for (int j = 0; j < segs; j++) {
+                for (int i = 0; i < segs; i++) {
+                    int corner[4];
+                    const int du[4] = {0, 1, 1, 0}, dv[4] = {0, 0, 1, 1};
+                    for (int k = 0; k < 4; k++) {
+                        int g[3];
+                        g[axis] = side ? segs : 0;
+                        // the -axis face swaps u and v to turn its winding around
+                        g[side ? b : c] = i + du[k];
+                        g[side ? c : b] = j + dv[k];
+                        corner[k] = id[(g[2] * n + g[1]) * n + g[0]];
+                    }
+                    qm_addq(m, corner[0], corner[1], corner[2], corner[3]);
+                }
+            }
+        }
+    }
+}
+
+static void cube_counts(int segs, int *nv, int *nq) {
+    int n = segs + 1, inner = segs - 1;
+    *nv = n * n * n - inner * inner * inner;
+    *nq = 6 * segs * segs;
+}
+
+void mesh_box(QMesh *m, float sx, float sy, float sz, int segs) {
+    if (segs < 1) return;
+    int nv, nq;
+    cube_counts(segs, &nv, &nq);
+    qm_reserve(m, m->vCount + nv, m->qCount + nq);
+    int *id = cube_lattice(m, segs, false, sx, sy, sz);
+    cube_faces(m, id, segs);
+    free(id);
+}
+
+void mesh_sphere(QMesh *m, float r, int segs) {
+    if (segs < 1) return;
+    int nv, nq;
+    cube_counts(segs, &nv, &nq);
+    qm_reserve(m, m->vCount + nv, m->qCount + nq);
+    int *id = cube_lattice(m, segs, true, r, r, r);
+    cube_faces(m, id, segs);
+    free(id);
+}
+
+void mesh_torus(QMesh *m, float R, float r, int segs, int sides) {
+    if (segs < 3 || sides < 3) return;
+    qm_reserve(m, m->vCount + segs * sides, m->qCount + segs * sides);
+    int first = m->vCount;
+    for (int i = 0; i < segs; i++) {
+        float u = (float) i / (float) segs * 2.0f * PI, cu = cosf(u), su = sinf(u);
+        for (int j = 0; j < sides; j++) {
+            float w = (float) j / (float) sides * 2.0f * PI;
+            float rr = R + r * cosf(w);
+            qm_addv(m, (Vector3) {rr * cu, rr * su, r * sinf(w)});
+        }
+    }
+    for (int i = 0; i < segs; i++) {
+        int i1 = (i + 1) % segs;
+        for (int j = 0; j < sides; j++) {
+            int j1 = (j + 1) % sides;
+            qm_addq(m, first + i * sides + j, first + i1 * sides + j, first + i1 * sides + j1, first + i * sides + j1);
+        }
+    }
+}
+
+// Rotation-minimizing frames by double reflection (Wang et al. 2008): each frame is the previous
+// one reflected across the bisector of the step, then across the new tangent. Repeated path
+// points are dropped first: a zero-length step has no tangent to build a frame from.
+void mesh_sweep(QMesh *m, const Vector3 *profile, int pc, const Vector3 *pathIn, int pathCount, float twist,
+                float endScale, bool caps) {
+    if (pc < 3 || pathCount < 2) return;
+    Vector3 *path = (Vector3 *) malloc(sizeof(Vector3) * (size_t) pathCount);
+    Vector3 *T = (Vector3 *) malloc(sizeof(Vector3) * (size_t) pathCount);
+    float *len = (float *) malloc(sizeof(float) * (size_t) pathCount);
+    if (!path || !T || !len) abort();
+    int n = 0;
+    for (int i = 0; i < pathCount; i++)
+        if (n == 0 || Vector3DistanceSqr(pathIn[i], path[n - 1]) > 0.0f) path[n++] = pathIn[i];
+    if (n < 2) {
+        free(len);
+        free(T);
+        free(path);
+        return;
+    }
+    int dv = 0, dq = 0;
+    if (caps) disc_counts(pc, &dv, &dq);
+    qm_reserve(m, m->vCount + pc * n + dv * 2, m->qCount + pc * (n - 1) + dq * 2);
+
+    len[0] = 0.0f;
+    for (int i = 0; i < n; i++) {
+        Vector3 a = path[i > 0 ? i - 1 : 0], b = path[i < n - 1 ? i + 1 : n - 1];
+        T[i] = Vector3Normalize(Vector3Subtract(b, a));
+        if (i > 0) len[i] = len[i - 1] + Vector3Distance(path[i - 1], path[i]);
+    }
+    const float total = len[n - 1] > 0.0f ? len[n - 1] : 1.0f;
+
+    // the start frame keeps world X as the profile's x axis where it can, so a path up +Z
+    // places the profile exactly as drawn
+    Vector3 N = (Vector3) {1, 0, 0};
+    if (fabsf(T[0].x) > 0.9f) N = (Vector3) {0, 1, 0};
+    N = Vector3Normalize(Vector3Subtract(N, Vector3Scale(T[0], Vector3DotProduct(N, T[0]))));
+
+    const int first = m->vCount;
+    for (int i = 0; i < n; i++) {
+        if (i > 0) {
+            Vector3 v1 = Vector3Subtract(path[i], path[i - 1]);
+            float c1 = Vector3DotProduct(v1, v1);
+            if (c1 > 0.0f) {
+                Vector3 NL = Vector3Subtract(N, Vector3Scale(v1, 2.0f / c1 * Vector3DotProduct(v1, N)));
+                Vector3 TL = Vector3Subtract(T[i - 1], Vector3Scale(v1, 2.0f / c1 * Vector3DotProduct(v1, T[i - 1])));
+                Vector3 v2 = Vector3Subtract(T[i], TL);
+                float c2 = Vector3DotProduct(v2, v2);
+                N = c2 > 0.0f ? Vector3Subtract(NL, Vector3Scale(v2, 2.0f / c2 * Vector3DotProduct(v2, NL))) : NL;
+            }
+        }
+        Vector3 B = Vector3CrossProduct(T[i], N);
+        float t = len[i] / total;
+        float ang = twist * t, ca = cosf(ang), sa = sinf(ang);
+        float sc = 1.0f + (endScale - 1.0f) * t;
+        Vector3 X = Vector3Scale(Vector3Add(Vector3Scale(N, ca), Vector3Scale(B, sa)), sc);
+        Vector3 Y = Vector3Scale(Vector3Subtract(Vector3Scale(B, ca), Vector3Scale(N, sa)), sc);
+        for (int k = 0; k < pc; k++)
+            qm_addv(m, Vector3Add(path[i], Vector3Add(Vector3Scale(X, profile[k].x), Vector3Scale(Y, profile[k].y))));
+    }
+    for (int i = 0; i < n - 1; i++) band(m, first + i * pc, first + (i + 1) * pc, pc);
+    if (caps) {
+        disc(m, first, pc, false);
+        disc(m, first + (n - 1) * pc, pc, true);
+    }
+    free(len);
+    free(T);
+    free(path);
+}
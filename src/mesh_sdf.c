@@ -0,0 +1,442 @@
+#include "mesh.h"
+#include "mesh_simd.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+// Signed distance trees and a dual contouring polygonizer. Samples live on a regular grid of
+// corners; a cell whose corners disagree in sign gets one vertex, and every grid edge with a sign
+// change becomes the quad joining the four cells around it.
+
+#define SDF_BLOCK 8          // corners per block edge while sampling
+#define SDF_PAR_MIN 65536    // cells before the per-slab passes go parallel
+#define SDF_EIG_TOL 0.1f     // QEF eigenvalues below this fraction of the largest count as zero
+#define SDF_EDGE_STEPS 4     // refinement steps for each edge crossing
+
+static const int CELL_EDGE[12][2] = {
+        {0, 1}, {2, 3}, {4, 5}, {6, 7},  // along x
+        {0, 2}, {1, 3}, {4, 6}, {5, 7},  // along y
+        {0, 4}, {1, 5}, {2, 6}, {3, 7},  // along z
+};
+
+float sdf_eval(const QSdf *s, Vector3 p) {
+    switch (s->op) {
+        case QSDF_SPHERE: {
+            float dx = p.x - s->p[0], dy = p.y - s->p[1], dz = p.z - s->p[2];
+            return sqrtf(dx * dx + dy * dy + dz * dz) - s->p[3];
+        }
+        case QSDF_BOX: {
+            const float r = s->p[6];
+            float q[3], out = 0.0f;
+            const float d[3] = {p.x - s->p[0], p.y - s->p[1], p.z - s->p[2]};
+            for (int k = 0; k < 3; k++) {
+                q[k] = fabsf(d[k]) - fmaxf(s->p[3 + k] - r, 0.0f);
+                float o = fmaxf(q[k], 0.0f);
+                out += o * o;
+            }
+            return sqrtf(out) + fminf(fmaxf(q[0], fmaxf(q[1], q[2])), 0.0f) - r;
+        }
+        case QSDF_CAPSULE: {
+            Vector3 a = {s->p[0], s->p[1], s->p[2]}, b = {s->p[3], s->p[4], s->p[5]};
+            Vector3 ab = Vector3Subtract(b, a), ap = Vector3Subtract(p, a);
+            float len2 = Vector3DotProduct(ab, ab);
+            float t = len2 > 0.0f ? Clamp(Vector3DotProduct(ap, ab) / len2, 0.0f, 1.0f) : 0.0f;
+            return Vector3Length(Vector3Subtract(ap, Vector3Scale(ab, t))) - s->p[6];
+        }
+        case QSDF_UNION:
+            return fminf(sdf_eval(s->a, p), sdf_eval(s->b, p));
+        case QSDF_SMOOTH_UNION: {
+            float a = sdf_eval(s->a, p), b = sdf_eval(s->b, p), k = s->p[0];
+            if (k <= 0.0f) return fminf(a, b);
+            // polynomial smooth minimum: at most k/4 below min(a, b), only where they are within k
+            float h = fmaxf(k - fabsf(a - b), 0.0f) / k;
+            return fminf(a, b) - h * h * k * 0.25f;
+        }
+        case QSDF_SUBTRACT:
+            return fmaxf(sdf_eval(s->a, p), -sdf_eval(s->b, p));
+        case QSDF_INTERSECT:
+            return fmaxf(sdf_eval(s->a, p), sdf_eval(s->b, p));
+        case QSDF_ROUND:
+            return sdf_eval(s->a, p) - s->p[0];
+        default:
+            return INFINITY;
+    }
+}
+
+void sdf_bounds(const QSdf *s, float mn[3], float mx[3]) {
+    float grow = 0.0f;
+    switch (s->op) {
+        case QSDF_SPHERE:
+        case QSDF_BOX:
+            for (int k = 0; k < 3; k++) {
+                float r = s->op == QSDF_SPHERE ? s->p[3] : s->p[3 + k];
+                mn[k] = s->p[k] - r;
+                mx[k] = s->p[k] + r;
+            }
+            return;
+        case QSDF_CAPSULE:
+            for (int k = 0; k < 3; k++) {
+                mn[k] = fminf(s->p[k], s->p[3 + k]) - s->p[6];
+                mx[k] = fmaxf(s->p[k], s->p[3 + k]) + s->p[6];
+            }
+            return;
+        case QSDF_SMOOTH_UNION:
+            grow = fmaxf(s->p[0], 0.0f) * 0.25f;
+            // fall through
+        case QSDF_UNION:
+        case QSDF_INTERSECT: {
+            float bmn[3], bmx[3];
+            sdf_bounds(s->a, mn, mx);
+            sdf_bounds(s->b, bmn, bmx);
+            for (int k = 0; k < 3; k++) {
+                if (s->op == QSDF_INTERSECT) {
+                    mn[k] = fmaxf(mn[k], bmn[k]);
+                    mx[k] = fminf(mx[k], bmx[k]);
+                } else {
+                    mn[k] = fminf(mn[k], bmn[k]) - grow;
+                    mx[k] = fmaxf(mx[k], bmx[k]) + grow;
+                }
+            }
+            return;
+        }
+        case QSDF_ROUND:
+            grow = fmaxf(s->p[0], 0.0f);
+            // fall through
+        case QSDF_SUBTRACT:
+            sdf_bounds(s->a, mn, mx);
+            for (int k = 0; k < 3; k++) {
+                mn[k] -= grow;
+                mx[k] += grow;
+            }
+            return;
+        default:
+            for (int k = 0; k < 3; k++) {
+                mn[k] = INFINITY;
+                mx[k] = -INFINITY;
+            }
+    }
+}
+
+typedef struct {
+    const QSdf *s;
+    int n[3], c[3];  // cells and corners per axis
+    float o[3], h;   // position of corner (0, 0, 0) and the cell size
+    float *f;        // corner samples, x fastest
+    int *cell;       // cell -> vertex, or -1
+} SdfGrid;
+
+static size_t grid_corner(const SdfGrid *g, int x, int y, int z) {
+    return ((size_t) z * (size_t) g->c[1] + (size_t) y) * (size_t) g->c[0] + (size_t) x;
+}
+
+static size_t grid_cell(const SdfGrid *g, int x, int y, int z) {
+    return ((size_t) z * (size_t) g->n[1] + (size_t) y) * (size_t) g->n[0] + (size_t) x;
+}
+
+static Vector3 grid_point(const SdfGrid *g, float x, float y, float z) {
+    return (Vector3) {g->o[0] + x * g->h, g->o[1] + y * g->h, g->o[2] + z * g->h};
+}
+
+// Fills one block of corners. Every corner lies within r of the block centre, so when the
+// distance there exceeds r plus a cell, no corner of the block or next to it can have the other
+// sign; the block then takes the centre value, which is never interpolated.
+static void sample_block(const SdfGrid *g, int b, const int nb[3]) {
+    const int bx = b % nb[0], by = (b / nb[0]) % nb[1], bz = b / (nb[0] * nb[1]);
+    const int x0 = bx * SDF_BLOCK, y0 = by * SDF_BLOCK, z0 = bz * SDF_BLOCK;
+    const int x1 = x0 + SDF_BLOCK < g->c[0] ? x0 + SDF_BLOCK : g->c[0];
+    const int y1 = y0 + SDF_BLOCK < g->c[1] ? y0 + SDF_BLOCK : g->c[1];
+    const int z1 = z0 + SDF_BLOCK < g->c[2] ? z0 + SDF_BLOCK : g->c[2];
+    const float ex = (float) (x1 - 1 - x0), ey = (float) (y1 - 1 - y0), ez = (float) (z1 - 1 - z0);
+    const float r = 0.5f * g->h * sqrtf(ex * ex + ey * ey + ez * ez);
+    const float d = sdf_eval(g->s, grid_point(g, (float) x0 + 0.5f * ex, (float) y0 + 0.5f * ey,
+                                              (float) z0 + 0.5f * ez));
+    const bool skip = fabsf(d) > r + g->h;
+    for (int z = z0; z < z1; z++) {
+        for (int y = y0; y < y1; y++) {
+            float *row = g->f + grid_corner(g, 0, y, z);
+            for (int x = x0; x < x1; x++)
+                row[x] = skip ? d : sdf_eval(g->s, grid_point(g, (float) x, (float) y, (float) z));
+        }
+    }
+}
+
+// Inside bits of corners (x, y, z), (x, y + 1, z), (x, y, z + 1), (x, y + 1, z + 1), spread to
+// the even bits of a cell mask. Bit k of a cell's mask is its corner k (x = k & 1, y = k >> 1 & 1,
+// z = k >> 2), so a cell's mask is its lower column ORed with its upper one shifted by one.
+static int column_bits(const SdfGrid *g, int x, int y, int z) {
+    const float *f = g->f;
+    const size_t i = grid_corner(g, x, y, z), dy = (size_t) g->c[0], dz = dy * (size_t) g->c[1];
+    return (f[i] < 0.0f) | (f[i + dy] < 0.0f) << 2 | (f[i + dz] < 0.0f) << 4 | (f[i + dy + dz] < 0.0f) << 6;
+}
+
+static Vector3 sdf_normal(const QSdf *s, Vector3 p, float e) {
+    Vector3 n = {
+            sdf_eval(s, (Vector3) {p.x + e, p.y, p.z}) - sdf_eval(s, (Vector3) {p.x - e, p.y, p.z}),
+            sdf_eval(s, (Vector3) {p.x, p.y + e, p.z}) - sdf_eval(s, (Vector3) {p.x, p.y - e, p.z}),
+            sdf_eval(s, (Vector3) {p.x, p.y, p.z + e}) - sdf_eval(s, (Vector3) {p.x, p.y, p.z - e}),
+    };
+    float len = Vector3Length(n);
+    return len > 0.0f ? Vector3Scale(n, 1.0f / len) : (Vector3) {0, 0, 0};
+}
+
+// Zero of the distance along a-b by a few false-position steps, stopping within tol; the
+// samples alone are only linear in the distance where one face of the shape is nearest.
+static Vector3 edge_crossing(const QSdf *s, Vector3 a, Vector3 b, float fa, float fb, float tol) {
+    Vector3 p = Vector3Lerp(a, b, fa / (fa - fb));
+    for (int it = 0; it < SDF_EDGE_STEPS; it++) {
+        float fp = sdf_eval(s, p);
+        if (fabsf(fp) <= tol) break;
+        if ((fp < 0.0f) == (fa < 0.0f)) {
+            a = p;
+            fa = fp;
+        } else {
+            b = p;
+            fb = fp;
+        }
+        p = Vector3Lerp(a, b, fa / (fa - fb));
+    }
+    return p;
+}
+
+// Least-squares x for the symmetric A x = b (A packed xx xy xz yy yz zz) through a Jacobi
+// eigendecomposition. Directions with small eigenvalues are left at zero, so flat and edge
+// cells keep the mass point along the directions their normals don't pin down.
+static void qef_solve(const float a6[6], const float b[3], float x[3]) {
+    float A[3][3] = {{a6[0], a6[1], a6[2]}, {a6[1], a6[3], a6[4]}, {a6[2], a6[4], a6[5]}};
+    float V[3][3] = {{1, 0, 0}, {0, 1, 0}, {0, 0, 1}};
+    for (int sweep = 0; sweep < 8; sweep++) {
+        if (A[0][1] * A[0][1] + A[0][2] * A[0][2] + A[1][2] * A[1][2] < 1e-12f) break;
+        for (int p = 0; p < 2; p++) {
+            for (int q = p + 1; q < 3; q++) {
+                if (fabsf(A[p][q]) < 1e-12f) continue;
+                float theta = (A[q][q] - A[p][p]) / (2.0f * A[p][q]);
+                float t = (theta >= 0.0f ? 1.0f : -1.0f) / (fabsf(theta) + sqrtf(theta * theta + 1.0f));
+                float c = 1.0f / sqrtf(t * t + 1.0f), s = t * c;
+                for (int k = 0; k < 3; k++) {
+                    float akp = A[k][p], akq = A[k][q];
+                    A[k][p] = c * akp - s * akq;
+                    A[k][q] = s * akp + c * akq;
+                }
+                for (int k = 0; k < 3; k++) {
+                    float apk = A[p][k], aqk = A[q][k];
+                    A[p][k] = c * apk - s * aqk;
+                    A[q][k] = s * apk + c * aqk;
+                }
+                for (int k = 0; k < 3; k++) {
+                    float vkp = V[k][p], vkq = V[k][q];
+                    V[k][p] = c * vkp - s * vkq;
+                    V[k][q] = s * vkp + c * vkq;
+                }
+            }
+        }
+    }
+    float lmax = fmaxf(fabsf(A[0][0]), fmaxf(fabsf(A[1][1]), fabsf(A[2][2])));
+    x[0] = x[1] = x[2] = 0.0f;
+    for (int i = 0; i < 3; i++) {
+        if (!(A[i][i] > SDF_EIG_TOL * lmax)) continue;
+        float w = (V[0][i] * b[0] + V[1][i] * b[1] + V[2][i] * b[2]) / A[i][i];
+        for (int k = 0; k < 3; k++) x[k] += w * V[k][i];
+    }
+}
+
+// Minimizes the squared distances to the tangent planes at the cell's edge crossings, solved
+// around their mass point, then clamps the result to the cell.
+static Vector3 cell_vertex(const SdfGrid *g, int x, int y, int z, int mask) {
+    float fc[8], ata[6] = {0}, atb[3] = {0}, mp[3] = {0};
+    Vector3 pc[8];
+    for (int k = 0; k < 8; k++) {
+        int cx = x + (k & 1), cy = y + (k >> 1 & 1), cz = z + (k >> 2);
+        fc[k] = g->f[grid_corner(g, cx, cy, cz)];
+        pc[k] = grid_point(g, (float) cx, (float) cy, (float) cz);
+    }
+    int count = 0;
+    for (int e = 0; e < 12; e++) {
+        const int a = CELL_EDGE[e][0], b = CELL_EDGE[e][1];
+        if ((mask >> a & 1) == (mask >> b & 1)) continue;
+        Vector3 p = edge_crossing(g->s, pc[a], pc[b], fc[a], fc[b], g->h * 1e-4f);
+        Vector3 n = sdf_normal(g->s, p, g->h * 0.01f);
+        const float nv[3] = {n.x, n.y, n.z}, pv[3] = {p.x, p.y, p.z};
+        const float d = Vector3DotProduct(n, p);
+        ata[0] += nv[0] * nv[0];
+        ata[1] += nv[0] * nv[1];
+        ata[2] += nv[0] * nv[2];
+        ata[3] += nv[1] * nv[1];
+        ata[4] += nv[1] * nv[2];
+        ata[5] += nv[2] * nv[2];
+        for (int k = 0; k < 3; k++) {
+            atb[k] += nv[k] * d;
+            mp[k] += pv[k];
+        }
+        count++;
+    }
+    for (int k = 0; k < 3; k++) mp[k] /= (float) count;
+    const float r[3] = {
+            atb[0] - (ata[0] * mp[0] + ata[1] * mp[1] + ata[2] * mp[2]),
+            atb[1] - (ata[1] * mp[0] + ata[3] * mp[1] + ata[4] * mp[2]),
+            atb[2] - (ata[2] * mp[0] + ata[4] * mp[1] + ata[5] * mp[2]),
+    };
+    float dx[3];
+    qef_solve(ata, r, dx);
+    return (Vector3) {
+            Clamp(mp[0] + dx[0], pc[0].x, pc[7].x),
+            Clamp(mp[1] + dx[1], pc[0].y, pc[7].y),
+            Clamp(mp[2] + dx[2], pc[0].z, pc[7].z),
+    };
+}
+
+// Cells around a crossed edge in counter-clockwise order seen from its upper end; reversed when
+// the upper end is the inside one, so the quad faces out of the surface.
+static Quad edge_quad(const SdfGrid *g, const size_t c[4], bool lowerInside, int base) {
+    int a = base + g->cell[c[0]], b = base + g->cell[c[1]], cc = base + g->cell[c[2]], d = base + g->cell[c[3]];
+    return lowerInside ? (Quad) {a, b, cc, d} : (Quad) {d, cc, b, a};
+}
+
+// Quads for the crossed edges whose lower corner sits in corner slab z, in a fixed order;
+// only counts them when out is NULL. Edges on the grid boundary lack a cell on one side and
+// get no quad. The grid keeps a cell of margin, so they only cross where the bounds cut the
+// shape, which leaves the surface open there.
+static int slab_quads(const SdfGrid *g, int z, Quad *out, int base) {
+    int nq = 0;
+    for (int y = 0; y < g->c[1]; y++) {
+        for (int x = 0; x < g->c[0]; x++) {
+            const bool in = g->f[grid_corner(g, x, y, z)] < 0.0f;
+            if (x < g->n[0] && y >= 1 && y < g->n[1] && z >= 1 && z < g->n[2] &&
+                in != (g->f[grid_corner(g, x + 1, y, z)] < 0.0f)) {
+                const size_t c[4] = {grid_cell(g, x, y - 1, z - 1), grid_cell(g, x, y, z - 1),
+                                     grid_cell(g, x, y, z), grid_cell(g, x, y - 1, z)};
+                if (out) out[nq] = edge_quad(g, c, in, base);
+                nq++;
+            }
+            if (y < g->n[1] && x >= 1 && x < g->n[0] && z >= 1 && z < g->n[2] &&
+                in != (g->f[grid_corner(g, x, y + 1, z)] < 0.0f)) {
+                const size_t c[4] = {grid_cell(g, x - 1, y, z - 1), grid_cell(g, x - 1, y, z),
+                                     grid_cell(g, x, y, z), grid_cell(g, x, y, z - 1)};
+                if (out) out[nq] = edge_quad(g, c, in, base);
+                nq++;
+            }
+            if (z < g->n[2] && x >= 1 && x < g->n[0] && y >= 1 && y < g->n[1] &&
+                in != (g->f[grid_corner(g, x, y, z + 1)] < 0.0f)) {
+                const size_t c[4] = {grid_cell(g, x - 1, y - 1, z), grid_cell(g, x, y - 1, z),
+                                     grid_cell(g, x, y, z), grid_cell(g, x - 1, y, z)};
+                if (out) out[nq] = edge_quad(g, c, in, base);
+                nq++;
+            }
+        }
+    }
+    return nq;
+}
+
+// Drops the vertices no quad uses, which cells along a cut through the bounds can leave, and
+// renumbers the quads to match; returns the vertices kept.
+static int drop_unused(Vector3 *pos, int nv, Quad *quads, int nq, int base) {
+    int *remap = (int *) calloc((size_t) (nv ? nv : 1), sizeof(int));
+    if (!remap) abort();
+    for (int i = 0; i < nq; i++) {
+        const int *c = (const int *) &quads[i];
+        for (int k = 0; k < 4; k++) remap[c[k] - base] = 1;
+    }
+    int kept = 0;
+    for (int i = 0; i < nv; i++) {
+        if (!remap[i]) continue;
+        pos[kept] = pos[i];
+        remap[i] = kept++;
+    }
+    if (kept < nv) {
+        for (int i = 0; i < nq; i++) {
+            int *c = (int *) &quads[i];
+            for (int k = 0; k < 4; k++) c[k] = base + remap[c[k] - base];
+        }
+    }
+    free(remap);
+    return kept;
+}
+
+void mesh_polygonize(QMesh *m, const QSdf *s, const float mn[3], const float mx[3], int res) {
+    float ext = 0.0f;
+    for (int k = 0; k < 3; k++) ext = fmaxf(ext, mx[k] - mn[k]);
+    if (!(ext > 0.0f) || !isfinite(ext) || res < 1) return;
+
+    SdfGrid g;
+    g.s = s;
+    g.h = ext / (float) res;
+    for (int k = 0; k < 3; k++) {
+        if (!(mx[k] >= mn[k])) return;
+        int n = (int) ceilf((mx[k] - mn[k]) / g.h - 1e-3f);
+        g.n[k] = (n > 1 ? n : 1) + 2;
+        g.c[k] = g.n[k] + 1;
+        g.o[k] = 0.5f * (mn[k] + mx[k]) - 0.5f * g.h * (float) g.n[k];
+    }
+    const size_t corners = (size_t) g.c[0] * (size_t) g.c[1] * (size_t) g.c[2];
+    const size_t cells = (size_t) g.n[0] * (size_t) g.n[1] * (size_t) g.n[2];
+    g.f = (float *) malloc(sizeof(float) * corners);
+    g.cell = (int *) malloc(sizeof(int) * cells);
+    int *vStart = (int *) malloc(sizeof(int) * (size_t) (g.n[2] + 1));
+    int *qStart = (int *) malloc(sizeof(int) * (size_t) (g.c[2] + 1));
+    if (!g.f || !g.cell || !vStart || !qStart) abort();
+
+    const int nb[3] = {(g.c[0] + SDF_BLOCK - 1) / SDF_BLOCK, (g.c[1] + SDF_BLOCK - 1) / SDF_BLOCK,
+                       (g.c[2] + SDF_BLOCK - 1) / SDF_BLOCK};
+    const int blocks = nb[0] * nb[1] * nb[2];
+MESH_OMP(omp parallel for schedule(dynamic) if (blocks > 1))
+    for (int b = 0; b < blocks; b++) sample_block(&g, b, nb);
+
+    // vertices are numbered cell by cell, x fastest, whatever the thread count
+    vStart[0] = 0;
+MESH_OMP(omp parallel for schedule(dynamic) if (cells >= SDF_PAR_MIN))
+    for (int z = 0; z < g.n[2]; z++) {
+        int n = 0;
+        for (int y = 0; y < g.n[1]; y++) {
+            int lo = column_bits(&g, 0, y, z);
+            int *row = g.cell + grid_cell(&g, 0, y, z);
+            for (int x = 0; x < g.n[0]; x++) {
+                int hi = column_bits(&g, x + 1, y, z);
+                row[x] = lo | hi << 1;  // the mask, until the vertex pass replaces it
+                n += row[x] != 0 && row[x] != 255;
+                lo = hi;
+            }
+        }
+        vStart[z + 1] = n;
+    }
+    for (int z = 0; z < g.n[2]; z++) vStart[z + 1] += vStart[z];
+    int nv = vStart[g.n[2]];
+    Vector3 *pos = (Vector3 *) malloc(sizeof(Vector3) * (size_t) (nv ? nv : 1));
+    if (!pos) abort();
+MESH_OMP(omp parallel for schedule(dynamic) if (cells >= SDF_PAR_MIN))
+    for (int z = 0; z < g.n[2]; z++) {
+        int next = vStart[z];
+        for (int y = 0; y < g.n[1]; y++) {
+            for (int x = 0; x < g.n[0]; x++) {
+                size_t c = grid_cell(&g, x, y, z);
+                int mask = g.cell[c];
+                if (mask == 0 || mask == 255) {
+                    g.cell[c] = -1;
+                    continue;
+                }
+                g.cell[c] = next;
+                pos[next++] = cell_vertex(&g, x, y, z, mask);
+            }
+        }
+    }
+
+    const int base = m->vCount;
+    qStart[0] = 0;
+MESH_OMP(omp parallel for schedule(dynamic) if (cells >= SDF_PAR_MIN))
+    for (int z = 0; z < g.c[2]; z++) qStart[z + 1] = slab_quads(&g, z, NULL, base);
+    for (int z = 0; z < g.c[2]; z++) qStart[z + 1] += qStart[z];
+    const int nq = qStart[g.c[2]];
+    Quad *quads = (Quad *) malloc(sizeof(Quad) * (size_t) (nq ? nq : 1));
+    if (!quads) abort();
+MESH_OMP(omp parallel for schedule(dynamic) if (cells >= SDF_PAR_MIN))
+    for (int z = 0; z < g.c[2]; z++) slab_quads(&g, z, quads + qStart[z], base);
+    nv = drop_unused(pos, nv, quads, nq, base);
+
+    qm_reserve(m, base + nv, m->qCount + nq);
+    qm_addv_n(m, pos, nv);
+    qm_addq_n(m, quads, nq);
+    free(quads);
+    free(pos);
+    free(qStart);
+    free(vStart);
+    free(g.cell);
+    free(g.f);
+}
@@ -0,0 +1,357 @@
+#include "mesh_simd.h"
+#include <stddef.h>
+
+static void translate_scalar(float *xyz, int n, float dx, float dy, float dz) {
+    for (int i = 0; i < n; i++) {
+        xyz[i * 3 + 0] += dx;
+        xyz[i * 3 + 1] += dy;
+        xyz[i * 3 + 2] += dz;
+    }
+}
+
+static void scale_scalar(float *xyz, int n, float sx, float sy, float sz) {
+    for (int i = 0; i < n; i++) {
+        xyz[i * 3 + 0] *= sx;
+        xyz[i * 3 + 1] *= sy;
+        xyz[i * 3 + 2] *= sz;
+    }
+}
+
+static void affine_scalar(float *dst, const float *src, int n, const float m[12]) {
+    for (int i = 0; i < n; i++) {
+        float x = src[i * 3 + 0], y = src[i * 3 + 1], z = src[i * 3 + 2];
+        dst[i * 3 + 0] = m[0] * x + m[1] * y + m[2] * z + m[3];
+        dst[i * 3 + 1] = m[4] * x + m[5] * y + m[6] * z + m[7];
+        dst[i * 3 + 2] = m[8] * x + m[9] * y + m[10] * z + m[11];
+    }
+}
+
+static void bbox_scalar(const float *xyz, int n, float mn[3], float mx[3]) {
+    if (n <= 0) {
+        mn[0] = mn[1] = mn[2] = mx[0] = mx[1] = mx[2] = 0.0f;
+        return;
+    }
+    for (int k = 0; k < 3; k++) mn[k] = mx[k] = xyz[k];
+    for (int i = 1; i < n; i++) {
+        for (int k = 0; k < 3; k++) {
+            float v = xyz[i * 3 + k];
+            if (v < mn[k]) mn[k] = v;
+            if (v > mx[k]) mx[k] = v;
+        }
+    }
+}
+
+static void offset_idx_scalar(int *dst, const int *src, int n, int off) {
+    for (int i = 0; i < n; i++) dst[i] = src[i] + off;
+}
+
+static float dist2_scalar(const float *xyz, int i, int j) {
+    float dx = xyz[i * 3 + 0] - xyz[j * 3 + 0];
+    float dy = xyz[i * 3 + 1] - xyz[j * 3 + 1];
+    float dz = xyz[i * 3 + 2] - xyz[j * 3 + 2];
+    return dx * dx + dy * dy + dz * dz;
+}
+
+static void short_diag_scalar(const float *xyz, const int *quads, int n, unsigned char *bd) {
+    for (int i = 0; i < n; i++) {
+        const int *q = quads + i * 4;
+        bd[i] = (unsigned char) (dist2_scalar(xyz, q[1], q[3]) < dist2_scalar(xyz, q[0], q[2]));
+    }
+}
+
+static const MeshKernels K_SCALAR = {
+        "scalar", translate_scalar, scale_scalar, affine_scalar, bbox_scalar, offset_idx_scalar,
+        short_diag_scalar
+};
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MESH_SIMD_X86 1
+#include <immintrin.h>
+
+// xyz streams repeat every 4 vertices in 128-bit lanes (12 floats = 3 registers) and every
+// 8 vertices in 256-bit lanes; per-axis constants are laid out in the same repeating pattern.
+
+__attribute__((target("sse2")))
+static void translate_sse2(float *xyz, int n, float dx, float dy, float dz) {
+    const float d[3] = {dx, dy, dz};
+    float pat[12];
+    for (int k = 0; k < 12; k++) pat[k] = d[k % 3];
+    __m128 p0 = _mm_loadu_ps(pat), p1 = _mm_loadu_ps(pat + 4), p2 = _mm_loadu_ps(pat + 8);
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        float *s = xyz + i * 3;
+        _mm_storeu_ps(s, _mm_add_ps(_mm_loadu_ps(s), p0));
+        _mm_storeu_ps(s + 4, _mm_add_ps(_mm_loadu_ps(s + 4), p1));
+        _mm_storeu_ps(s + 8, _mm_add_ps(_mm_loadu_ps(s + 8), p2));
+    }
+    translate_scalar(xyz + i * 3, n - i, dx, dy, dz);
+}
+
+__attribute__((target("sse2")))
+static void scale_sse2(float *xyz, int n, float sx, float sy, float sz) {
+    const float d[3] = {sx, sy, sz};
+    float pat[12];
+    for (int k = 0; k < 12; k++) pat[k] = d[k % 3];
+    __m128 p0 = _mm_loadu_ps(pat), p1 = _mm_loadu_ps(pat + 4), p2 = _mm_loadu_ps(pat + 8);
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        float *s = xyz + i * 3;
+        _mm_storeu_ps(s, _mm_mul_ps(_mm_loadu_ps(s), p0));
+        _mm_storeu_ps(s + 4, _mm_mul_ps(_mm_loadu_ps(s + 4), p1));
+        _mm_storeu_ps(s + 8, _mm_mul_ps(_mm_loadu_ps(s + 8), p2));
+    }
+    scale_scalar(xyz + i * 3, n - i, sx, sy, sz);
+}
+
+// 4 vertices per step: deinterleave (x0 y0 z0 x1)(y1 z1 x2 y2)(z2 x3 y3 z3) into X/Y/Z
+// registers, apply the matrix, interleave back.
+__attribute__((target("sse2")))
+static void affine_sse2(float *dst, const float *src, int n, const float m[12]) {
+    const __m128 m0 = _mm_set1_ps(m[0]), m1 = _mm_set1_ps(m[1]), m2 = _mm_set1_ps(m[2]), m3 = _mm_set1_ps(m[3]);
+    const __m128 m4 = _mm_set1_ps(m[4]), m5 = _mm_set1_ps(m[5]), m6 = _mm_set1_ps(m[6]), m7 = _mm_set1_ps(m[7]);
+    const __m128 m8 = _mm_set1_ps(m[8]), m9 = _mm_set1_ps(m[9]), m10 = _mm_set1_ps(m[10]), m11 = _mm_set1_ps(m[11]);
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const float *s = src + i * 3;
+        float *d = dst + i * 3;
+        __m128 a = _mm_loadu_ps(s), b = _mm_loadu_ps(s + 4), c = _mm_loadu_ps(s + 8);
+        __m128 t0 = _mm_shuffle_ps(b, c, _MM_SHUFFLE(2, 1, 3, 2));
+        __m128 t1 = _mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 0, 2, 1));
+        __m128 X = _mm_shuffle_ps(a, t0, _MM_SHUFFLE(2, 0, 3, 0));
+        __m128 Y = _mm_shuffle_ps(t1, t0, _MM_SHUFFLE(3, 1, 2, 0));
+        __m128 Z = _mm_shuffle_ps(t1, c, _MM_SHUFFLE(3, 0, 3, 1));
+
+        __m128 NX = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(m0, X), _mm_mul_ps(m1, Y)), _mm_mul_ps(m2, Z)), m3);
+        __m128 NY = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(m4, X), _mm_mul_ps(m5, Y)), _mm_mul_ps(m6, Z)), m7);
+        __m128 NZ = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(m8, X), _mm_mul_ps(m9, Y)), _mm_mul_ps(m10, Z)), m11);
+
+        __m128 xy = _mm_unpacklo_ps(NX, NY);
+        __m128 zx = _mm_shuffle_ps(NZ, NX, _MM_SHUFFLE(1, 1, 0, 0));
+        __m128 yz = _mm_unpacklo_ps(NY, NZ);
+        __m128 xyh = _mm_unpackhi_ps(NX, NY);
+        __m128 zxh = _mm_shuffle_ps(NZ, NX, _MM_SHUFFLE(3, 3, 2, 2));
+        __m128 yzh = _mm_unpackhi_ps(NY, NZ);
+        _mm_storeu_ps(d, _mm_shuffle_ps(xy, zx, _MM_SHUFFLE(2, 0, 1, 0)));
+        _mm_storeu_ps(d + 4, _mm_shuffle_ps(yz, xyh, _MM_SHUFFLE(1, 0, 3, 2)));
+        _mm_storeu_ps(d + 8, _mm_shuffle_ps(zxh, yzh, _MM_SHUFFLE(3, 2, 2, 0)));
+    }
+    affine_scalar(dst + i * 3, src + i * 3, n - i, m);
+}
+
+__attribute__((target("sse2")))
+static void bbox_sse2(const float *xyz, int n, float mn[3], float mx[3]) {
+    if (n < 4) {
+        bbox_scalar(xyz, n, mn, mx);
+        return;
+    }
+    __m128 n0 = _mm_loadu_ps(xyz), n1 = _mm_loadu_ps(xyz + 4), n2 = _mm_loadu_ps(xyz + 8);
+    __m128 x0 = n0, x1 = n1, x2 = n2;
+    int i = 4;
+    for (; i + 4 <= n; i += 4) {
+        const float *s = xyz + i * 3;
+        __m128 a = _mm_loadu_ps(s), b = _mm_loadu_ps(s + 4), c = _mm_loadu_ps(s + 8);
+        n0 = _mm_min_ps(n0, a);
+        n1 = _mm_min_ps(n1, b);
+        n2 = _mm_min_ps(n2, c);
+        x0 = _mm_max_ps(x0, a);
+        x1 = _mm_max_ps(x1, b);
+        x2 = _mm_max_ps(x2, c);
+    }
+    float lo[12], hi[12];
+    _mm_storeu_ps(lo, n0);
+    _mm_storeu_ps(lo + 4, n1);
+    _mm_storeu_ps(lo + 8, n2);
+    _mm_storeu_ps(hi, x0);
+    _mm_storeu_ps(hi + 4, x1);
+    _mm_storeu_ps(hi + 8, x2);
+    for (int k = 0; k < 3; k++) mn[k] = mx[k] = xyz[k];
+    for (int k = 0; k < 12; k++) {
+        if (lo[k] < mn[k % 3]) mn[k % 3] = lo[k];
+        if (hi[k] > mx[k % 3]) mx[k % 3] = hi[k];
+    }
+    for (; i < n; i++) {
+        for (int k = 0; k < 3; k++) {
+            float v = xyz[i * 3 + k];
+            if (v < mn[k]) mn[k] = v;
+            if (v > mx[k]) mx[k] = v;
+        }
+    }
+}
+
+__attribute__((target("sse2")))
+static void offset_idx_sse2(int *dst, const int *src, int n, int off) {
+    const __m128i o = _mm_set1_epi32(off);
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
+        _mm_storeu_si128((__m128i *) (dst + i), _mm_add_epi32(_mm_loadu_si128((const __m128i *) (src + i)), o));
+    offset_idx_scalar(dst + i, src + i, n - i, off);
+}
+
+// corners are gathered lane by lane (SSE2 has no gather); the distance math is vectorized in
+// the scalar kernel's operation order so both agree on every tie
+__attribute__((target("sse2")))
+static __m128 dist2_sse2(const float *xyz, const int *quads, int i, int c0, int c1) {
+    __m128 d[3];
+    for (int k = 0; k < 3; k++) {
+        __m128 p = _mm_setr_ps(xyz[quads[(i + 0) * 4 + c0] * 3 + k], xyz[quads[(i + 1) * 4 + c0] * 3 + k],
+                               xyz[quads[(i + 2) * 4 + c0] * 3 + k], xyz[quads[(i + 3) * 4 + c0] * 3 + k]);
+        __m128 r = _mm_setr_ps(xyz[quads[(i + 0) * 4 + c1] * 3 + k], xyz[quads[(i + 1) * 4 + c1] * 3 + k],
+                               xyz[quads[(i + 2) * 4 + c1] * 3 + k], xyz[quads[(i + 3) * 4 + c1] * 3 + k]);
+        d[k] = _mm_sub_ps(p, r);
+    }
+    return _mm_add_ps(_mm_add_ps(_mm_mul_ps(d[0], d[0]), _mm_mul_ps(d[1], d[1])), _mm_mul_ps(d[2], d[2]));
+}
+
+__attribute__((target("sse2")))
+static void short_diag_sse2(const float *xyz, const int *quads, int n, unsigned char *bd) {
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        int mask = _mm_movemask_ps(_mm_cmplt_ps(dist2_sse2(xyz, quads, i, 1, 3), dist2_sse2(xyz, quads, i, 0, 2)));
+        for (int k = 0; k < 4; k++) bd[i + k] = (unsigned char) ((mask >> k) & 1);
+    }
+    short_diag_scalar(xyz, quads + i * 4, n - i, bd + i);
+}
+
+__attribute__((target("avx2")))
+static __m256 dist2_avx2(const float *xyz, const int *quads, __m256i lane, int c0, int c1) {
+    const __m256i three = _mm256_set1_epi32(3);
+    __m256i p = _mm256_mullo_epi32(_mm256_i32gather_epi32(quads, _mm256_add_epi32(lane, _mm256_set1_epi32(c0)), 4), three);
+    __m256i r = _mm256_mullo_epi32(_mm256_i32gather_epi32(quads, _mm256_add_epi32(lane, _mm256_set1_epi32(c1)), 4), three);
+    __m256 d[3];
+    for (int k = 0; k < 3; k++) {
+        __m256 pk = _mm256_i32gather_ps(xyz + k, p, 4);
+        __m256 rk = _mm256_i32gather_ps(xyz + k, r, 4);
+        d[k] = _mm256_sub_ps(pk, rk);
+    }
+    return _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(d[0], d[0]), _mm256_mul_ps(d[1], d[1])), _mm256_mul_ps(d[2], d[2]));
+}
+
+__attribute__((target("avx2")))
+static void short_diag_avx2(const float *xyz, const int *quads, int n, unsigned char *bd) {
+    const __m256i lane = _mm256_setr_epi32(0, 4, 8, 12, 16, 20, 24, 28);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const int *q = quads + i * 4;
+        __m256 lt = _mm256_cmp_ps(dist2_avx2(xyz, q, lane, 1, 3), dist2_avx2(xyz, q, lane, 0, 2), _CMP_LT_OQ);
+        int mask = _mm256_movemask_ps(lt);
+        for (int k = 0; k < 8; k++) bd[i + k] = (unsigned char) ((mask >> k) & 1);
+    }
+    short_diag_sse2(xyz, quads + i * 4, n - i, bd + i);
+}
+
+__attribute__((target("avx2")))
+static void translate_avx2(float *xyz, int n, float dx, float dy, float dz) {
+    const float d[3] = {dx, dy, dz};
+    float pat[24];
+    for (int k = 0; k < 24; k++) pat[k] = d[k % 3];
+    __m256 p0 = _mm256_loadu_ps(pat), p1 = _mm256_loadu_ps(pat + 8), p2 = _mm256_loadu_ps(pat + 16);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        float *s = xyz + i * 3;
+        _mm256_storeu_ps(s, _mm256_add_ps(_mm256_loadu_ps(s), p0));
+        _mm256_storeu_ps(s + 8, _mm256_add_ps(_mm256_loadu_ps(s + 8), p1));
+        _mm256_storeu_ps(s + 16, _mm256_add_ps(_mm256_loadu_ps(s + 16), p2));
+    }
+    translate_scalar(xyz + i * 3, n - i, dx, dy, dz);
+}
+
+__attribute__((target("avx2")))
+static void scale_avx2(float *xyz, int n, float sx, float sy, float sz) {
+    const float d[3] = {sx, sy, sz};
+    float pat[24];
+    for (int k = 0; k < 24; k++) pat[k] = d[k % 3];
+    __m256 p0 = _mm256_loadu_ps(pat), p1 = _mm256_loadu_ps(pat + 8), p2 = _mm256_loadu_ps(pat + 16);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        float *s = xyz + i * 3;
+        _mm256_storeu_ps(s, _mm256_mul_ps(_mm256_loadu_ps(s), p0));
+        _mm256_storeu_ps(s + 8, _mm256_mul_ps(_mm256_loadu_ps(s + 8), p1));
+        _mm256_storeu_ps(s + 16, _mm256_mul_ps(_mm256_loadu_ps(s + 16), p2));
+    }
+    scale_scalar(xyz + i * 3, n - i, sx, sy, sz);
+}
+
+__attribute__((target("avx2")))
+static void bbox_avx2(const float *xyz, int n, float mn[3], float mx[3]) {
+    if (n < 8) {
+        bbox_sse2(xyz, n, mn, mx);
+        return;
+    }
+    __m256 n0 = _mm256_loadu_ps(xyz), n1 = _mm256_loadu_ps(xyz + 8), n2 = _mm256_loadu_ps(xyz + 16);
+    __m256 x0 = n0, x1 = n1, x2 = n2;
+    int i = 8;
+    for (; i + 8 <= n; i += 8) {
+        const float *s = xyz + i * 3;
+        __m256 a = _mm256_loadu_ps(s), b = _mm256_loadu_ps(s + 8), c = _mm256_loadu_ps(s + 16);
+        n0 = _mm256_min_ps(n0, a);
+        n1 = _mm256_min_ps(n1, b);
+        n2 = _mm256_min_ps(n2, c);
+        x0 = _mm256_max_ps(x0, a);
+        x1 = _mm256_max_ps(x1, b);
+        x2 = _mm256_max_ps(x2, c);
+    }
+    float lo[24], hi[24];
+    _mm256_storeu_ps(lo, n0);
+    _mm256_storeu_ps(lo + 8, n1);
+    _mm256_storeu_ps(lo + 16, n2);
+    _mm256_storeu_ps(hi, x0);
+    _mm256_storeu_ps(hi + 8, x1);
+    _mm256_storeu_ps(hi + 16, x2);
+    for (int k = 0; k < 3; k++) mn[k] = mx[k] = xyz[k];
+    for (int k = 0; k < 24; k++) {
+        if (lo[k] < mn[k % 3]) mn[k % 3] = lo[k];
+        if (hi[k] > mx[k % 3]) mx[k % 3] = hi[k];
+    }
+    for (; i < n; i++) {
+        for (int k = 0; k < 3; k++) {
+            float v = xyz[i * 3 + k];
+            if (v < mn[k]) mn[k] = v;
+            if (v > mx[k]) mx[k] = v;
+        }
+    }
+}
+
+__attribute__((target("avx2")))
+static void offset_idx_avx2(int *dst, const int *src, int n, int off) {
+    const __m256i o = _mm256_set1_epi32(off);
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+        _mm256_storeu_si256((__m256i *) (dst + i),
+                            _mm256_add_epi32(_mm256_loadu_si256((const __m256i *) (src + i)), o));
+    offset_idx_scalar(dst + i, src + i, n - i, off);
+}
+
+static const MeshKernels K_SSE2 = {
+        "sse2", translate_sse2, scale_sse2, affine_sse2, bbox_sse2, offset_idx_sse2, short_diag_sse2
+};
+
+// the 4-wide affine deinterleave has no cheaper 8-wide form; it stays on SSE2
+static const MeshKernels K_AVX2 = {
+        "avx2", translate_avx2, scale_avx2, affine_sse2, bbox_avx2, offset_idx_avx2, short_diag_avx2
+};
+#endif
+
+static const MeshKernels *kernels_sel = NULL;
+
+static void kernels_select(void) {
+    const MeshKernels *k = &K_SCALAR;
+#ifdef MESH_SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) k = &K_AVX2;
+    else if (__builtin_cpu_supports("sse2")) k = &K_SSE2;
+#endif
+    kernels_sel = k;
+}
+
+// Selected at load time where the compiler supports constructors, so threads only ever read
+// kernels_sel; elsewhere the first mesh_kernels() call must happen before any threads start.
+#ifdef __GNUC__
+__attribute__((constructor)) static void kernels_init(void) {
+    kernels_select();
+}
+#endif
+
+const MeshKernels *mesh_kernels(void) {
+    if (!kernels_sel) kernels_select();
+    return kernels_sel;
+}
@@ -0,0 +1,37 @@
+#ifndef MESH_SIMD_H
+#define MESH_SIMD_H
+
+// Bulk kernels over QMesh storage viewed as flat streams: positions as interleaved xyz floats
+// (float[3 * n]) and quads as int[4 * n]. mesh_kernels() picks the widest variant the CPU
+// supports, at load time with GCC/Clang and on first use elsewhere (then the first call must
+// come before any worker threads); every variant produces the same results as the scalar one.
+typedef struct {
+    const char *name;
+
+    void (*translate)(float *xyz, int n, float dx, float dy, float dz);
+
+    void (*scale)(float *xyz, int n, float sx, float sy, float sz);
+
+    // m is a row-major 3x4 matrix: x' = m[0]*x + m[1]*y + m[2]*z + m[3], ...
+    // dst may equal src for an in-place transform
+    void (*affine)(float *dst, const float *src, int n, const float m[12]);
+
+    void (*bbox)(const float *xyz, int n, float mn[3], float mx[3]);
+
+    void (*offset_idx)(int *dst, const int *src, int n, int off);
+
+    // bd[i] = 1 when quad i's b-d diagonal is strictly shorter than a-c, else 0
+    void (*short_diag)(const float *xyz, const int *quads, int n, unsigned char *bd);
+} MeshKernels;
+
+const MeshKernels *mesh_kernels(void);
+
+// MESH_OMP(omp parallel for ...) is that pragma when built with OpenMP and nothing otherwise,
+// so builds without it stay clean under -Wunknown-pragmas.
+#ifdef _OPENMP
+#define MESH_OMP(x) _Pragma(#x)
+#else
+#define MESH_OMP(x)
+#endif
+
+#endif
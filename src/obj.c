@@ -1,7 +1,34 @@
 #include "topolang.h"
+#include "mesh.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
+
+// Places m by a column-major 4x4: positions through the matrix, normals through its cofactor
+// matrix so non-uniform scales keep them perpendicular. Returns true when the matrix mirrors.
+static bool instance_apply(const float t[16], const TopoMesh *m, float *v, float *n) {
+    for (int i = 0; i < m->vCount; i++) {
+        const float *p = &m->vertices[i * 3];
+        for (int r = 0; r < 3; r++) v[i * 3 + r] = t[r] * p[0] + t[4 + r] * p[1] + t[8 + r] * p[2] + t[12 + r];
+    }
+    // columns of the linear part
+    const float a[3] = {t[0], t[1], t[2]}, b[3] = {t[4], t[5], t[6]}, c[3] = {t[8], t[9], t[10]};
+    // cofactor matrix rows: b x c, c x a, a x b
+    const float cof[9] = {b[1] * c[2] - b[2] * c[1], b[2] * c[0] - b[0] * c[2], b[0] * c[1] - b[1] * c[0],
+                          c[1] * a[2] - c[2] * a[1], c[2] * a[0] - c[0] * a[2], c[0] * a[1] - c[1] * a[0],
+                          a[1] * b[2] - a[2] * b[1], a[2] * b[0] - a[0] * b[2], a[0] * b[1] - a[1] * b[0]};
+    const float det = a[0] * cof[0] + a[1] * cof[1] + a[2] * cof[2];
+    for (int i = 0; n && i < m->vCount; i++) {
+        const float *s = &m->normals[i * 3];
+        float o[3];
+        for (int r = 0; r < 3; r++) o[r] = cof[r] * s[0] + cof[3 + r] * s[1] + cof[6 + r] * s[2];
+        float l = sqrtf(o[0] * o[0] + o[1] * o[1] + o[2] * o[2]);
+        if (det < 0.0f) l = -l;
+        for (int r = 0; r < 3; r++) n[i * 3 + r] = l != 0.0f ? o[r] / l : 0.0f;
+    }
+    return det < 0.0f;
+}
 
 bool topo_export_obj_ex(const TopoScene *scene, const char *outObjPath, int triangulate, TopoError *err) {
     FILE *f = fopen(outObjPath, "wb");
@@ -16,25 +43,56 @@ bool topo_export_obj_ex(const TopoScene *scene, const char *outObjPath, int tria
 
     fprintf(f, "# OBJ generated by Topolang\n");
 
+    // instances are written out as transformed copies, one object each
+    const bool inst = scene->instanceCount > 0;
+    const int objects = inst ? scene->instanceCount : scene->count;
+    float *xv = NULL, *xn = NULL;
+    int xCap = 0;
+    unsigned *tri = NULL;
+    int triCap = 0;
     int base = 0;
-    for (int mi = 0; mi < scene->count; mi++) {
-        const TopoMesh *m = &scene->meshes[mi];
+    for (int oi = 0; oi < objects; oi++) {
+        const TopoMesh *m = &scene->meshes[inst ? scene->instances[oi].mesh : oi];
+        const float *vs = m->vertices, *ns = m->normals;
+        bool flip = false;
+        if (inst) {
+            if (m->vCount > xCap) {
+                xCap = m->vCount;
+                free(xv);
+                free(xn);
+                xv = (float *) malloc(sizeof(float) * 3 * (size_t) xCap);
+                xn = (float *) malloc(sizeof(float) * 3 * (size_t) xCap);
+            }
+            flip = instance_apply(scene->instances[oi].transform, m, xv, ns ? xn : NULL);
+            vs = xv;
+            if (ns) ns = xn;
+        }
 
-        fprintf(f, "o mesh_%d\n", mi);
+        fprintf(f, "o mesh_%d\n", oi);
 
         for (int i = 0; i < m->vCount; i++) {
-            const float *p = &m->vertices[i * 3];
+            const float *p = &vs[i * 3];
             fprintf(f, "v %.9g %.9g %.9g\n", (double) p[0], (double) p[1], (double) p[2]);
         }
+        // normals share the vertex numbering, so faces reference both with the same index
+        const bool hasN = ns != NULL;
+        for (int i = 0; hasN && i < m->vCount; i++) {
+            const float *n = &ns[i * 3];
+            fprintf(f, "vn %.6g %.6g %.6g\n", (double) n[0], (double) n[1], (double) n[2]);
+        }
 
         if (triangulate) {
-            for (int qi = 0; qi < m->qCount; qi++) {
-                int a = m->quads[qi * 4 + 0] + base + 1;
-                int b = m->quads[qi * 4 + 1] + base + 1;
-                int c = m->quads[qi * 4 + 2] + base + 1;
-                int d = m->quads[qi * 4 + 3] + base + 1;
-                fprintf(f, "f %d %d %d\n", a, b, c);
-                fprintf(f, "f %d %d %d\n", a, c, d);
+            if (m->qCount * 6 > triCap) {
+                triCap = m->qCount * 6;
+                free(tri);
+                tri = (unsigned *) malloc(sizeof(unsigned) * (size_t) triCap);
+            }
+            mesh_triangulate_indices((const Vector3 *) m->vertices, (const Quad *) m->quads, m->qCount,
+                                     (unsigned) base + 1, 1, flip, tri);
+            for (int t = 0; t < m->qCount * 2; t++) {
+                unsigned a = tri[t * 3 + 0], b = tri[t * 3 + 1], c = tri[t * 3 + 2];
+                if (hasN) fprintf(f, "f %u//%u %u//%u %u//%u\n", a, a, b, b, c, c);
+                else fprintf(f, "f %u %u %u\n", a, b, c);
             }
         } else {
             for (int qi = 0; qi < m->qCount; qi++) {
@@ -42,13 +100,25 @@ bool topo_export_obj_ex(const TopoScene *scene, const char *outObjPath, int tria
                 int b = m->quads[qi * 4 + 1] + base + 1;
                 int c = m->quads[qi * 4 + 2] + base + 1;
                 int d = m->quads[qi * 4 + 3] + base + 1;
-                fprintf(f, "f %d %d %d %d\n", a, b, c, d);
+                if (flip) {
+                    int t = a;
+                    a = d;
+                    d = t;
+                    t = b;
+                    b = c;
+                    c = t;
+                }
+                if (hasN) fprintf(f, "f %d//%d %d//%d %d//%d %d//%d\n", a, a, b, b, c, c, d, d);
+                else fprintf(f, "f %d %d %d %d\n", a, b, c, d);
             }
         }
 
         base += m->vCount;
     }
 
+    free(xv);
+    free(xn);
+    free(tri);
     fclose(f);
     return true;
 }
@@ -9,6 +9,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdalign.h>
 
 extern AstProgram parse_program(const char *src, TopoArena *A, char err[256], int *line, int *col);
 
@@ -332,8 +333,123 @@ static void inject_parts_for_mesh(TopoArena *A, const Ast *meshAst, AstList *dst
     }
 }
 
+static void *arena_scratch(void *ud, size_t sz, size_t align) { return arena_alloc((TopoArena *) ud, sz, align); }
+
+// Compaction and crease splitting rewrite and grow the mesh. A value mesh may still carry the
+// allocator of the call that made it (a cap_plane result uses the builder's, whose Host is gone
+// once that call returns), so they run on a copy on the system heap, never on the value.
+static TopoMesh topo_mesh_from(const QMesh *src, const TopoExecOptions *opt, TopoArena *A) {
+    QMesh work, *q = &work;
+    qm_init(q);
+    mesh_merge(q, src);
+    size_t mark = arena_mark(A);
+    if (opt && opt->compact) mesh_compact(q, arena_scratch, A);
+    else mesh_share_refs(q, arena_scratch, A);
+    float *normals = NULL;
+    if (opt && opt->normals) normals = mesh_vertex_normals(q, opt->crease_deg * DEG2RAD, arena_scratch, A);
+    arena_release(A, mark);
+    TopoMesh m = (TopoMesh){0};
+    m.normals = normals;
+    m.vCount = q->vCount;
+    m.vertices = (float *) malloc(sizeof(float) * 3 * (size_t) m.vCount);
+    for (int i = 0; i < q->vCount; i++) {
+        m.vertices[i * 3 + 0] = q->v[i].x;
+        m.vertices[i * 3 + 1] = q->v[i].y;
+        m.vertices[i * 3 + 2] = q->v[i].z;
+    }
+    m.qCount = q->qCount;
+    m.quads = (int *) malloc(sizeof(int) * 4 * (size_t) m.qCount);
+    for (int i = 0; i < q->qCount; i++) {
+        m.quads[i * 4 + 0] = q->q[i].a;
+        m.quads[i * 4 + 1] = q->q[i].b;
+        m.quads[i * 4 + 2] = q->q[i].c;
+        m.quads[i * 4 + 3] = q->q[i].d;
+    }
+    qm_free(q);
+    return m;
+}
+
+static void instance_matrix(const float xf[12], float out[16]) {
+    for (int c = 0; c < 4; c++) {
+        for (int r = 0; r < 3; r++) out[c * 4 + r] = xf[r * 4 + c];
+        out[c * 4 + 3] = c == 3 ? 1.0f : 0.0f;
+    }
+}
+
+// Bases placed once are flattened into a root mesh, which keeps builder-shared vertices
+// joinable; bases placed more than once become scene meshes of their own. Without any of the
+// latter the scene is the single flattened mesh.
+static void scene_from_instances(const QMesh *q, const TopoExecOptions *opt, TopoArena *A, TopoScene *out) {
+    const int n = q->instCount;
+    size_t mark = arena_mark(A);
+    unsigned cap = 64;
+    while (cap < (unsigned) n * 2u) cap <<= 1;
+    const unsigned mask = cap - 1;
+    int *slots = (int *) arena_alloc(A, sizeof(int) * ((size_t) cap + 3 * (size_t) n), alignof(int));
+    int *first = slots + cap, *uses = first + n, *sceneMesh = uses + n;
+    for (unsigned i = 0; i < cap; i++) slots[i] = -1;
+    for (int i = 0; i < n; i++) {
+        const QMesh *b = q->inst[i].base;
+        unsigned h = (unsigned) (((size_t) b >> 4) * 0x9e3779b1u) & mask;
+        while (slots[h] >= 0 && q->inst[slots[h]].base != b) h = (h + 1) & mask;
+        if (slots[h] < 0) slots[h] = i;
+        first[i] = slots[h];
+        uses[i] = 0;
+        uses[first[i]]++;
+    }
+
+    QMesh root, once;
+    qm_init(&root);
+    qm_init(&once);
+    once.inst = (QMeshInst *) arena_alloc(A, sizeof(QMeshInst) * (size_t) n, alignof(QMeshInst));
+    int shared = 0, placed = 0;
+    for (int i = 0; i < n; i++) {
+        if (uses[first[i]] == 1) once.inst[once.instCount++] = q->inst[i];
+        else {
+            placed++;
+            if (first[i] == i) shared++;
+        }
+    }
+    mesh_merge(&root, &once);
+    const bool hasRoot = root.qCount > 0 || shared == 0;
+
+    out->count = (hasRoot ? 1 : 0) + shared;
+    out->meshes = (TopoMesh *) malloc(sizeof(TopoMesh) * (size_t) out->count);
+    out->instanceCount = (hasRoot && shared ? 1 : 0) + placed;
+    out->instances = out->instanceCount ? (TopoInstance *) malloc(sizeof(TopoInstance) * (size_t) out->instanceCount)
+                                        : NULL;
+    int mi = 0, ii = 0;
+    if (hasRoot) {
+        out->meshes[mi] = topo_mesh_from(&root, opt, A);
+        if (shared) {
+            static const float identity[12] = {1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0};
+            out->instances[ii].mesh = mi;
+            instance_matrix(identity, out->instances[ii++].transform);
+        }
+        mi++;
+    }
+    qm_free(&root);
+    for (int i = 0; i < n && shared; i++) {
+        if (uses[first[i]] == 1) continue;
+        if (first[i] == i) {
+            sceneMesh[i] = mi;
+            // bases are shared values, possibly placed by other meshes too; the copy
+            // topo_mesh_from prepares leaves them as they are
+            out->meshes[mi++] = topo_mesh_from(q->inst[i].base, opt, A);
+        }
+        out->instances[ii].mesh = sceneMesh[first[i]];
+        instance_matrix(q->inst[i].xf, out->instances[ii++].transform);
+    }
+    arena_release(A, mark);
+}
+
 bool topo_execute(const TopoProgram *prog, const char *entryMeshName,
                   TopoArena *A, TopoScene *outScene, TopoError *err) {
+    return topo_execute_ex(prog, entryMeshName, NULL, A, outScene, err);
+}
+
+bool topo_execute_ex(const TopoProgram *prog, const char *entryMeshName, const TopoExecOptions *opt,
+                     TopoArena *A, TopoScene *outScene, TopoError *err) {
     const Ast *mesh = NULL;
     for (int i = 0; i < prog->count; i++) {
         if (!strcmp(prog->entries[i].name, entryMeshName)) { mesh = prog->entries[i].meshAst; break; }
@@ -385,27 +501,17 @@ bool topo_execute(const TopoProgram *prog, const char *entryMeshName,
         return false;
     }
 
-    QMesh *q = R.ret.mesh;
-    TopoMesh m = (TopoMesh){0};
-    m.vCount = q->vCount;
-    m.vertices = (float *) malloc(sizeof(float) * 3 * (size_t) m.vCount);
-    for (int i = 0; i < q->vCount; i++) {
-        m.vertices[i * 3 + 0] = q->v[i].x;
-        m.vertices[i * 3 + 1] = q->v[i].y;
-        m.vertices[i * 3 + 2] = q->v[i].z;
-    }
-    m.qCount = q->qCount;
-    m.quads = (int *) malloc(sizeof(int) * 4 * (size_t) m.qCount);
-    for (int i = 0; i < q->qCount; i++) {
-        m.quads[i * 4 + 0] = q->q[i].a;
-        m.quads[i * 4 + 1] = q->q[i].b;
-        m.quads[i * 4 + 2] = q->q[i].c;
-        m.quads[i * 4 + 3] = q->q[i].d;
+    // the copy topo_mesh_from works on flattens instances on the way
+    const QMesh *q = R.ret.mesh;
+    if (q->instCount && opt && opt->instances) {
+        scene_from_instances(q, opt, A, outScene);
+        return true;
     }
-
     outScene->count = 1;
     outScene->meshes = (TopoMesh *) malloc(sizeof(TopoMesh));
-    outScene->meshes[0] = m;
+    outScene->meshes[0] = topo_mesh_from(q, opt, A);
+    outScene->instances = NULL;
+    outScene->instanceCount = 0;
     return true;
 }
 
@@ -413,8 +519,10 @@ void topo_free_mesh(TopoMesh *m) {
     if (!m) return;
     free(m->vertices);
     free(m->quads);
+    free(m->normals);
     m->vertices = NULL;
     m->quads = NULL;
+    m->normals = NULL;
     m->vCount = m->qCount = 0;
 }
 
@@ -422,6 +530,9 @@ void topo_free_scene(TopoScene *s) {
     if (!s) return;
     for (int i = 0; i < s->count; i++) topo_free_mesh(&s->meshes[i]);
     free(s->meshes);
+    free(s->instances);
     s->meshes = NULL;
     s->count = 0;
+    s->instances = NULL;
+    s->instanceCount = 0;
 }
@@ -22,6 +22,8 @@ static int map_type(const char *t) {
     if (!strcmp(t, "ring")) return VAL_RING;
     if (!strcmp(t, "ringlist")) return VAL_RINGLIST;
     if (!strcmp(t, "mesh")) return VAL_MESH;
+    if (!strcmp(t, "bbox")) return VAL_BBOX;
+    if (!strcmp(t, "sdf")) return VAL_SDF;
     if (!strcmp(t, "void")) return VAL_VOID;
     return -1;
 }
@@ -40,6 +42,10 @@ static const char *val_kind_str(int k) {
             return "ringlist";
         case VAL_MESH:
             return "mesh";
+        case VAL_BBOX:
+            return "bbox";
+        case VAL_SDF:
+            return "sdf";
         case VAL_VOID:
             return "void";
         default:
@@ -129,27 +135,37 @@ static void value_to_string(Host *H, Value v, char out[256]) {
         sappend(out, 256, ")");
         return;
     }
+    if (v.k == VAL_MESH && v.mesh && v.mesh->instCount) {
+        float mn[3], mx[3];
+        mesh_bbox(v.mesh, mn, mx);
+        snprintf(out, 256, "mesh(instances=%d,bbox=[%.3f,%.3f,%.3f]-[%.3f,%.3f,%.3f])",
+                 v.mesh->instCount, mn[0], mn[1], mn[2], mx[0], mx[1], mx[2]);
+        return;
+    }
     if (v.k == VAL_MESH) {
         int vc = v.mesh ? v.mesh->vCount : 0;
         int qc = v.mesh ? v.mesh->qCount : 0;
         if (v.mesh && vc > 0) {
-            Vector3 mn = v.mesh->v[0], mx = v.mesh->v[0];
-            for (int i = 1; i < vc; i++) {
-                Vector3 p = v.mesh->v[i];
-                if (p.x < mn.x) mn.x = p.x;
-                if (p.y < mn.y) mn.y = p.y;
-                if (p.z < mn.z) mn.z = p.z;
-                if (p.x > mx.x) mx.x = p.x;
-                if (p.y > mx.y) mx.y = p.y;
-                if (p.z > mx.z) mx.z = p.z;
-            }
+            float mn[3], mx[3];
+            mesh_bbox(v.mesh, mn, mx);
             snprintf(out, 256, "mesh(v=%d,q=%d,bbox=[%.3f,%.3f,%.3f]-[%.3f,%.3f,%.3f])",
-                     vc, qc, mn.x, mn.y, mn.z, mx.x, mx.y, mx.z);
+                     vc, qc, mn[0], mn[1], mn[2], mx[0], mx[1], mx[2]);
         } else {
             snprintf(out, 256, "mesh(v=%d,q=%d)", vc, qc);
         }
         return;
     }
+    if (v.k == VAL_BBOX) {
+        const float *b = v.bbox;
+        snprintf(out, 256, "bbox([%.3f,%.3f,%.3f]-[%.3f,%.3f,%.3f])", b[0], b[1], b[2], b[3], b[4], b[5]);
+        return;
+    }
+    if (v.k == VAL_SDF && v.sdf) {
+        float mn[3], mx[3];
+        sdf_bounds(v.sdf, mn, mx);
+        snprintf(out, 256, "sdf(bounds=[%.3f,%.3f,%.3f]-[%.3f,%.3f,%.3f])", mn[0], mn[1], mn[2], mx[0], mx[1], mx[2]);
+        return;
+    }
     snprintf(out, 256, "%s", val_kind_str(v.k));
 }
 